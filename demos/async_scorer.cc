@@ -0,0 +1,72 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "async_scorer.h"
+
+#include <utility>
+
+#include "cache_sidechannel.h"
+#include "cpu_isolation.h"
+
+AsyncScorer::AsyncScorer(int cpu) : thread_(&AsyncScorer::Score, this, cpu) {}
+
+AsyncScorer::~AsyncScorer() {
+  stop_.store(true, std::memory_order_relaxed);
+  thread_.join();
+}
+
+bool AsyncScorer::Submit(const std::array<uint64_t, 256> &latencies,
+                         char safe_offset_char) {
+  round_.latencies = latencies;
+  round_.safe_offset_char = safe_offset_char;
+  round_.byte = byte_;
+  return ring_.TryPush(round_);
+}
+
+bool AsyncScorer::Converged(char *value) const {
+  int64_t converged = converged_.load(std::memory_order_acquire);
+  if (converged < 0 || static_cast<uint32_t>(converged >> 8) != byte_) {
+    return false;
+  }
+  *value = static_cast<char>(converged & 0xFF);
+  return true;
+}
+
+void AsyncScorer::Score(int cpu) {
+  if (cpu != -1 && PinCurrentThreadToCpu(cpu)) {
+    pinned_cpu_.store(cpu, std::memory_order_release);
+  }
+
+  std::array<int, 257> scores = {};
+  uint32_t byte = 0;
+  Round round;
+  while (!stop_.load(std::memory_order_relaxed)) {
+    if (!ring_.TryPop(&round)) {
+      std::this_thread::yield();
+      continue;
+    }
+    if (round.byte != byte) {
+      scores.fill(0);
+      byte = round.byte;
+    }
+
+    int hit = CacheSideChannel::DecodeLatencies(round.latencies,
+                                                round.safe_offset_char);
+    if (hit == -1) {
+      continue;
+    }
+    ++scores[hit];
+
+    std::pair<bool, int> result = CacheSideChannel::DecideScores(scores);
+    if (result.first) {
+      converged_.store(static_cast<int64_t>(byte) * 256 + result.second,
+                       std::memory_order_release);
+    }
+  }
+}
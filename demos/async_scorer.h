@@ -0,0 +1,104 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_ASYNC_SCORER_H_
+#define DEMOS_ASYNC_SCORER_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#include "spsc_ring.h"
+
+// Scores CacheSideChannel rounds on a separate thread.
+//
+// With CacheSideChannel::RecomputeScores the thread running the gadget also
+// decodes every round (sorting 256 latencies and more) before it can start
+// the next one. AsyncScorer takes that off the critical path: the probe thread
+// only measures the oracle with CacheSideChannel::MeasureLatencies and hands
+// the raw latencies over through a lock-free SpscRing, and a scorer thread
+// decodes them, keeps the scores and publishes the leaked value through an
+// atomic once it wins with the same margin RecomputeScores requires. Probe
+// rounds then run back to back.
+//
+// The scorer should run on another physical core (see DistantCpu), not on an
+// SMT sibling of the probe, where it would compete for the caches and
+// execution units the measurement relies on. It busy-polls the ring, yielding
+// when it is empty, so on a machine with a single CPU it still works, only
+// without the speedup.
+//
+// All methods except the constructor and destructor must be called from the
+// one probe thread.
+//
+// Example use:
+//
+//     CacheSideChannel sidechannel;
+//     AsyncScorer scorer(DistantCpu(CurrentCpu()));
+//     std::array<uint64_t, 256> latencies;
+//     char value;
+//     for (size_t i = 0; i < secret_size; ++i) {
+//       scorer.NextByte();
+//       while (!scorer.Converged(&value)) {
+//         sidechannel.FlushOracle();
+//         // ... gadget accesses the oracle, plus a hit at safe_offset ...
+//         if (sidechannel.MeasureLatencies(&latencies)) {
+//           while (!scorer.Submit(latencies, safe_offset)) {
+//             std::this_thread::yield();
+//           }
+//         }
+//       }
+//     }
+class AsyncScorer {
+ public:
+  // Starts the scorer thread, pinned to `cpu` unless it is -1.
+  explicit AsyncScorer(int cpu = -1);
+  ~AsyncScorer();
+
+  AsyncScorer(const AsyncScorer &) = delete;
+  AsyncScorer &operator=(const AsyncScorer &) = delete;
+
+  // Starts leaking a new byte: rounds submitted from now on are scored from
+  // zero, and Converged() reports only on them.
+  void NextByte() { ++byte_; }
+
+  // Hands one round over to the scorer. Returns false, dropping nothing, if
+  // the scorer is behind and its queue is full; the caller can retry.
+  bool Submit(const std::array<uint64_t, 256> &latencies,
+              char safe_offset_char);
+
+  // Returns true and sets `*value` once the rounds of the current byte have
+  // converged.
+  bool Converged(char *value) const;
+
+  // The CPU the scorer thread runs on, or -1 if it isn't pinned (yet).
+  int cpu() const { return pinned_cpu_.load(std::memory_order_acquire); }
+
+ private:
+  struct Round {
+    std::array<uint64_t, 256> latencies;
+    char safe_offset_char;
+    uint32_t byte;
+  };
+
+  void Score(int cpu);
+
+  SpscRing<Round, 64> ring_;
+  // Written by the probe thread only.
+  uint32_t byte_ = 0;
+  Round round_;
+  // The converged byte number and value, as byte * 256 + value, or -1.
+  std::atomic<int64_t> converged_{-1};
+  std::atomic<int> pinned_cpu_{-1};
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+#endif  // DEMOS_ASYNC_SCORER_H_
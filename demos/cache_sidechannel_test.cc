@@ -0,0 +1,61 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "cache_sidechannel.h"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "utils.h"
+
+// Leaks every byte value through its own CacheSideChannel, with several
+// channels running concurrently in separate threads. The "leak" is an
+// architectural read of the oracle, so every channel must find exactly the
+// value it was given; anything else is cross-talk between the instances.
+int main() {
+  const int kThreads = 4;
+  const int kValuesPerThread = 256 / kThreads;
+  std::vector<int> found(256, -1);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([t, &found]() {
+      for (int i = 0; i < kValuesPerThread; ++i) {
+        int value = t * kValuesPerThread + i;
+        CacheSideChannel sidechannel;
+        for (int run = 0; run < 100000; ++run) {
+          sidechannel.FlushOracle();
+          ForceRead(&sidechannel.GetOracle()[value]);
+          std::pair<bool, char> result =
+              sidechannel.AddHitAndRecomputeScores();
+          if (result.first) {
+            found[value] = static_cast<unsigned char>(result.second);
+            break;
+          }
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  int errors = 0;
+  for (int value = 0; value < 256; ++value) {
+    if (found[value] != value) {
+      std::cout << "Leaked " << found[value] << " instead of " << value
+                << std::endl;
+      ++errors;
+    }
+  }
+  std::cout << "Leaked " << 256 - errors << " of 256 values correctly with "
+            << kThreads << " concurrent threads." << std::endl;
+  return errors != 0;
+}
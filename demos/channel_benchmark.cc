@@ -0,0 +1,511 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * Benchmarks the cache and TLB timing side-channels of the support library,
+ * with and without background noise.
+ *
+ * Each channel leaks a random "secret" one byte at a time. Instead of a
+ * speculative gadget, the secret-dependent oracle access is an ordinary read,
+ * so the numbers describe the channel and its decoder alone: how many bytes
+ * per second it delivers and how many of them are wrong. For every noise
+ * profile the benchmark steps through increasing intensities (number of noise
+ * threads) to show how each channel degrades under load.
+ *
+ * Usage:
+ *     channel_benchmark [--noise=none|all|<profile>[,<profile>...]]
+ *                       [--max-threads=<n>] [--bytes=<n>] [--realtime]
+ *                       [--policies] [--numa]
+ *
+ * --noise        Noise profiles to run under, see safeside_noise. "none" only
+ *                measures the idle baseline. Defaults to "all".
+ * --max-threads  Highest noise intensity. Defaults to 4.
+ * --bytes        Bytes leaked per measurement. Defaults to 256.
+ * --realtime     Measure in RealtimeMode and discard disturbed rounds.
+ * --policies     Also measure every combination of SideChannel policies, to
+ *                pick the best one for this host.
+ * --numa         Also measure without noise with the oracles and the secret
+ *                on every NUMA node in turn, to compare leaking from local
+ *                and from remote memory.
+ **/
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asm/measurereadlatency.h"
+#include "async_scorer.h"
+#include "cache_sidechannel.h"
+#include "cpu_isolation.h"
+#include "frequency_monitor.h"
+#include "instr.h"
+#include "noise_generator.h"
+#include "numa.h"
+#include "prefetch_probe.h"
+#include "realtime.h"
+#include "reliable_leak.h"
+#include "side_channel.h"
+#include "soft_decoder.h"
+#include "timing_array.h"
+#include "tlb_channel.h"
+#include "utils.h"
+
+namespace {
+
+// The secret, on the same NUMA node as the oracles.
+using Secret = std::vector<int, OracleNodeAllocator<int>>;
+
+// Leaks `secret` through a side-channel and returns what was read. Gets an
+// InterruptDetector to attach to its channel, or nullptr, and the
+// FrequencyMonitor for channels that calibrate a threshold.
+using LeakFunction = std::function<std::vector<int>(
+    const Secret &secret, InterruptDetector *detector,
+    FrequencyMonitor *frequency_monitor)>;
+
+struct Channel {
+  std::string name;
+  LeakFunction leak;
+};
+
+// Gives up on a byte after this many rounds and records it as wrong.
+constexpr int kMaxRoundsPerByte = 100000;
+
+std::vector<int> LeakWithTimingArray(const Secret &secret,
+                                     InterruptDetector *detector,
+                                     FrequencyMonitor *frequency_monitor) {
+  TimingArray timing_array;
+  timing_array.SetInterruptDetector(detector);
+  timing_array.SetFrequencyMonitor(frequency_monitor);
+
+  std::vector<int> leaked;
+  for (int value : secret) {
+    int found = -1;
+    for (int round = 0; found == -1 && round < kMaxRoundsPerByte; ++round) {
+      timing_array.FlushFromCache();
+      ForceRead(&timing_array[value]);
+      found = timing_array.FindFirstCachedElementIndex();
+    }
+    leaked.push_back(found);
+  }
+  return leaked;
+}
+
+std::vector<int> LeakWithCacheSideChannel(const Secret &secret,
+                                          InterruptDetector *detector,
+                                          FrequencyMonitor *) {
+  std::vector<int> leaked;
+  for (int value : secret) {
+    // Scores accumulate per channel, so every byte needs a fresh one.
+    CacheSideChannel sidechannel;
+    sidechannel.SetInterruptDetector(detector);
+    std::pair<bool, char> result;
+    for (int round = 0; round < kMaxRoundsPerByte; ++round) {
+      sidechannel.FlushOracle();
+      ForceRead(&sidechannel.GetOracle()[value]);
+      result = sidechannel.AddHitAndRecomputeScores();
+      if (result.first) {
+        break;
+      }
+    }
+    leaked.push_back(result.first ? static_cast<unsigned char>(result.second)
+                                  : -1);
+  }
+  return leaked;
+}
+
+// TimingArray, CacheSideChannel and TlbChannel with per-round voting in
+// ReliableLeak instead of their own decision rules.
+
+std::vector<int> Values(const std::vector<LeakedByte> &leaked) {
+  std::vector<int> values;
+  for (const LeakedByte &byte : leaked) {
+    values.push_back(byte.value);
+  }
+  return values;
+}
+
+std::vector<int> LeakWithTimingArrayVoting(
+    const Secret &secret, InterruptDetector *detector,
+    FrequencyMonitor *frequency_monitor) {
+  TimingArray timing_array;
+  timing_array.SetInterruptDetector(detector);
+  timing_array.SetFrequencyMonitor(frequency_monitor);
+  return Values(ReliableLeak(secret.size(), [&](size_t offset) {
+    timing_array.FlushFromCache();
+    ForceRead(&timing_array[secret[offset]]);
+    return timing_array.FindFirstCachedElementIndex();
+  }));
+}
+
+std::vector<int> LeakWithCacheSideChannelVoting(
+    const Secret &secret, InterruptDetector *detector,
+    FrequencyMonitor *) {
+  CacheSideChannel sidechannel;
+  sidechannel.SetInterruptDetector(detector);
+  size_t safe_offset = 0;
+  return Values(ReliableLeak(secret.size(), [&](size_t offset) {
+    // Like AddHitAndRecomputeScores, provide the reference hit at an offset
+    // that changes every round.
+    safe_offset = (safe_offset + 167) & 0xFF;
+    sidechannel.FlushOracle();
+    ForceRead(&sidechannel.GetOracle()[safe_offset]);
+    ForceRead(&sidechannel.GetOracle()[secret[offset]]);
+    return sidechannel.FindAccessedIndex(static_cast<char>(safe_offset));
+  }));
+}
+
+// TlbChannel with voting, since single scans are often wrong. On virtualized
+// hosts it doesn't converge, see tlb_channel.h. It has no frequency monitor:
+// its thresholds are calibrated per element, well below the misses.
+std::vector<int> LeakWithTlbChannelVoting(const Secret &secret,
+                                          InterruptDetector *detector,
+                                          FrequencyMonitor *) {
+  TlbChannel tlb;
+  tlb.SetInterruptDetector(detector);
+  return Values(ReliableLeak(secret.size(), [&](size_t offset) {
+    tlb.FlushFromCache();
+    ForceRead(&tlb[secret[offset]]);
+    return tlb.FindFirstCachedElementIndex();
+  }));
+}
+
+// CacheSideChannel with its rounds decoded and scored on another core, so the
+// probe loop only flushes, accesses and measures.
+std::vector<int> LeakWithCacheSideChannelAsync(const Secret &secret,
+                                               InterruptDetector *detector,
+                                               FrequencyMonitor *) {
+  CacheSideChannel sidechannel;
+  sidechannel.SetInterruptDetector(detector);
+  AsyncScorer scorer(DistantCpu(CurrentCpu()));
+  std::array<uint64_t, 256> latencies;
+  size_t safe_offset = 0;
+
+  std::vector<int> leaked;
+  for (int value : secret) {
+    scorer.NextByte();
+    char result;
+    bool converged = false;
+    for (int round = 0; !converged && round < kMaxRoundsPerByte; ++round) {
+      safe_offset = (safe_offset + 167) & 0xFF;
+      sidechannel.FlushOracle();
+      ForceRead(&sidechannel.GetOracle()[safe_offset]);
+      ForceRead(&sidechannel.GetOracle()[value]);
+      if (sidechannel.MeasureLatencies(&latencies)) {
+        while (!scorer.Submit(latencies, static_cast<char>(safe_offset))) {
+          std::this_thread::yield();
+        }
+      }
+      converged = scorer.Converged(&result);
+    }
+    leaked.push_back(converged ? static_cast<unsigned char>(result) : -1);
+  }
+  return leaked;
+}
+
+// Any SideChannel configuration, with a reference hit in every round.
+template <typename SideChannelT>
+std::vector<int> LeakWithSideChannel(const Secret &secret,
+                                     InterruptDetector *detector,
+                                     FrequencyMonitor *) {
+  SideChannelT channel;
+  channel.SetInterruptDetector(detector);
+
+  std::vector<int> leaked;
+  for (int value : secret) {
+    channel.NextByte();
+    std::pair<bool, int> result(false, -1);
+    for (int round = 0; !result.first && round < kMaxRoundsPerByte; ++round) {
+      channel.FlushOracle();
+      int reference = channel.AddReferenceHit();
+      ForceRead(&channel[value]);
+      result = channel.MeasureRound(reference);
+    }
+    leaked.push_back(result.first ? result.second : -1);
+  }
+  return leaked;
+}
+
+// Adds the SideChannel configurations with the given layout, timer and
+// classifier and every decider, named "<name>-<decider>".
+template <typename Layout, typename Timer, typename Classifier>
+void AddSideChannels(const std::string &name, std::vector<Channel> *channels) {
+  channels->push_back(
+      {name + "-first",
+       LeakWithSideChannel<
+           SideChannel<Layout, Timer, Classifier, FirstHitDecider>>});
+  channels->push_back(
+      {name + "-score",
+       LeakWithSideChannel<
+           SideChannel<Layout, Timer, Classifier, ScoreDecider>>});
+  channels->push_back(
+      {name + "-soft",
+       LeakWithSideChannel<
+           SideChannel<Layout, Timer, Classifier, SoftDecoder>>});
+}
+
+template <typename Layout, typename Timer>
+void AddSideChannels(const std::string &name, std::vector<Channel> *channels) {
+  AddSideChannels<Layout, Timer, ThresholdClassifier>(name + "-thr", channels);
+  AddSideChannels<Layout, Timer, MedianClassifier>(name + "-med", channels);
+}
+
+template <typename Layout>
+void AddSideChannels(const std::string &name, std::vector<Channel> *channels) {
+  AddSideChannels<Layout, ReadLatencyTimer>(name + "-mrl", channels);
+  AddSideChannels<Layout, TimestampTimer>(name + "-tsc", channels);
+}
+
+// CacheSideChannel with SoftDecoder instead of its own hard decisions.
+std::vector<int> LeakWithCacheSideChannelSoft(const Secret &secret,
+                                              InterruptDetector *detector,
+                                              FrequencyMonitor *) {
+  CacheSideChannel sidechannel;
+  sidechannel.SetInterruptDetector(detector);
+  SoftDecoder decoder;
+  std::array<uint64_t, 256> latencies;
+  size_t safe_offset = 0;
+
+  std::vector<int> leaked;
+  for (int value : secret) {
+    decoder.Reset();
+    std::pair<bool, int> result(false, -1);
+    for (int round = 0; !result.first && round < kMaxRoundsPerByte; ++round) {
+      safe_offset = (safe_offset + 167) & 0xFF;
+      sidechannel.FlushOracle();
+      ForceRead(&sidechannel.GetOracle()[safe_offset]);
+      ForceRead(&sidechannel.GetOracle()[value]);
+      if (sidechannel.MeasureLatencies(&latencies)) {
+        result = decoder.Add(latencies, static_cast<int>(safe_offset));
+      }
+    }
+    leaked.push_back(result.first ? result.second : -1);
+  }
+  return leaked;
+}
+
+// With `policies`, also every combination of SideChannel policies, named
+// "<layout>-<timer>-<classifier>-<decider>".
+std::vector<Channel> AllChannels(bool policies) {
+  std::vector<Channel> channels = {
+      {"timing-array", LeakWithTimingArray},
+      {"cache-sidechannel", LeakWithCacheSideChannel},
+      {"timing-array-vote", LeakWithTimingArrayVoting},
+      {"cache-sc-vote", LeakWithCacheSideChannelVoting},
+      {"cache-sc-async", LeakWithCacheSideChannelAsync},
+      {"cache-sc-soft", LeakWithCacheSideChannelSoft},
+      {"tlb-channel-vote", LeakWithTlbChannelVoting},
+  };
+  if (policies) {
+    AddSideChannels<TimingArrayLayout>("ta", &channels);
+    AddSideChannels<BigByteLayout>("bb", &channels);
+  }
+  return channels;
+}
+
+// Reports how often a single TlbChannel scan finds the accessed element and
+// how often a wrong one. That's what decides whether its voted row below can
+// converge.
+void PrintTlbChannelRates(std::ostream &out) {
+  TlbChannel tlb;
+  if (!tlb.ok()) {
+    out << "TlbChannel is not supported here." << std::endl;
+    return;
+  }
+
+  const int attempts = 10000;
+  int successes = 0;
+  int false_positives = 0;
+  for (int n = 0; n < attempts; ++n) {
+    int el = rand() & 0xFF;
+    tlb.FlushFromCache();
+    ForceRead(&tlb[el]);
+    int found = tlb.FindFirstCachedElementIndex();
+    if (found == el) {
+      ++successes;
+    } else if (found != -1) {
+      ++false_positives;
+    }
+  }
+  out << "TlbChannel: threshold " << tlb.cached_read_latency_threshold()
+      << ", evicted translations read in " << tlb.uncached_read_latency()
+      << ", first try right " << successes << " and wrong "
+      << false_positives << " of " << attempts << " times" << std::endl;
+}
+
+// Runs every channel once and prints a result row for each.
+void MeasureChannels(const std::string &noise, int threads, int bytes,
+                     bool realtime, bool policies,
+                     FrequencyMonitor *frequency_monitor) {
+  Secret secret;
+  for (int i = 0; i < bytes; ++i) {
+    secret.push_back(rand() & 0xFF);
+  }
+
+  for (const Channel &channel : AllChannels(policies)) {
+    std::unique_ptr<InterruptDetector> detector;
+    if (realtime) {
+      detector.reset(new InterruptDetector);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<int> leaked =
+        channel.leak(secret, detector.get(), frequency_monitor);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    int errors = 0;
+    for (int i = 0; i < bytes; ++i) {
+      if (leaked[i] != secret[i]) {
+        ++errors;
+      }
+    }
+
+    std::cout << std::left << std::setw(18) << noise << std::right
+              << std::setw(8) << threads << "  " << std::left << std::setw(20)
+              << channel.name << std::right << std::fixed
+              << std::setprecision(1) << std::setw(12)
+              << bytes / elapsed.count() << std::setprecision(4)
+              << std::setw(12) << static_cast<double>(errors) / bytes;
+    if (detector) {
+      std::cout << std::setw(14)
+                << std::to_string(detector->discarded_rounds()) + "/" +
+                       std::to_string(detector->rounds());
+    }
+    std::cout << std::endl;
+  }
+}
+
+// Places oracles on `node` from now on, and reports where a fresh one
+// actually landed and the median latency of its misses.
+void PlaceOraclesOn(int node) {
+  SetOracleNumaNode(node);
+  TimingArray timing_array;
+  std::vector<uint64_t> misses;
+  for (size_t i = 0; i < timing_array.size(); ++i) {
+    FlushDataCacheLine(&timing_array[i]);
+    misses.push_back(MeasureReadLatency(&timing_array[i]));
+  }
+  std::sort(misses.begin(), misses.end());
+  std::cout << "Probe on NUMA node " << CurrentNumaNode()
+            << ", oracles on node " << NumaNodeOfAddress(&timing_array[0])
+            << ", median miss latency " << misses[misses.size() / 2]
+            << std::endl;
+}
+
+// Returns the value of `--name=value` if `arg` is that flag.
+bool FlagValue(const std::string &arg, const std::string &name,
+               std::string *value) {
+  std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::vector<NoiseProfile> profiles = AllNoiseProfiles();
+  int max_threads = 4;
+  int bytes = 256;
+  bool realtime = false;
+  bool policies = false;
+  bool numa = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i], value;
+    if (FlagValue(arg, "noise", &value)) {
+      profiles.clear();
+      if (value == "all") {
+        profiles = AllNoiseProfiles();
+      } else if (value != "none") {
+        std::stringstream names(value);
+        std::string name;
+        while (std::getline(names, name, ',')) {
+          NoiseProfile profile;
+          if (!ParseNoiseProfile(name, &profile)) {
+            std::cerr << "Unknown noise profile " << name << std::endl;
+            return EXIT_FAILURE;
+          }
+          profiles.push_back(profile);
+        }
+      }
+    } else if (FlagValue(arg, "max-threads", &value)) {
+      max_threads = std::atoi(value.c_str());
+    } else if (FlagValue(arg, "bytes", &value)) {
+      bytes = std::atoi(value.c_str());
+    } else if (arg == "--realtime") {
+      realtime = true;
+    } else if (arg == "--policies") {
+      policies = true;
+    } else if (arg == "--numa") {
+      numa = true;
+    } else {
+      std::cerr << "Unknown argument " << arg << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+  std::unique_ptr<RealtimeMode> realtime_mode;
+  if (realtime) {
+    realtime_mode.reset(new RealtimeMode);
+    realtime_mode->PrintReport(std::cout);
+  }
+
+  // Warm the core up before anything calibrates, then keep watching its
+  // clock: the noise profiles change package power and thereby frequency.
+  FrequencyMonitor frequency_monitor;
+
+  // Pick the oracle permutations with the fewest prefetcher-induced false
+  // hits on this CPU. That also gets TimingArray's one-off threshold
+  // calibration out of the way so it doesn't count against the first row.
+  PrintPrefetcherBehavior(ProbePrefetchers(), std::cout);
+  SelectOraclePermutation(&std::cout);
+  PrintTlbChannelRates(std::cout);
+
+  std::cout << std::left << std::setw(18) << "noise" << std::right
+            << std::setw(8) << "threads" << "  " << std::left << std::setw(20)
+            << "channel" << std::right << std::setw(12) << "bytes/s"
+            << std::setw(12) << "error rate";
+  if (realtime) {
+    std::cout << std::setw(14) << "discarded";
+  }
+  std::cout << std::endl;
+
+  MeasureChannels("none", 0, bytes, realtime, policies, &frequency_monitor);
+  if (numa) {
+    for (int node : NumaNodes()) {
+      PlaceOraclesOn(node);
+      MeasureChannels("numa node " + std::to_string(node), 0, bytes,
+                      realtime, policies, &frequency_monitor);
+    }
+    SetOracleNumaNode(-1);
+  }
+  for (NoiseProfile profile : profiles) {
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+      NoiseGenerator noise(profile, threads);
+      MeasureChannels(NoiseProfileName(profile), threads, bytes, realtime,
+                      policies, &frequency_monitor);
+    }
+  }
+  frequency_monitor.PrintReport(std::cout);
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "core_types.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX
+#  include <dirent.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+
+#include "cpu_isolation.h"
+#include "instr.h"
+
+namespace {
+
+// A core type as found on the system, before numbering by speed.
+struct FoundType {
+  std::string name;
+  std::vector<int> cpus;
+  // Larger is faster. Capacity on ARM, otherwise a rank from the name.
+  uint64_t speed = 0;
+};
+
+// Big cores are called "core", small ones "atom" by Intel.
+uint64_t SpeedFromName(const std::string &name) {
+  if (name.find("core") != std::string::npos) {
+    return 2;
+  }
+  if (name.find("atom") != std::string::npos) {
+    return 1;
+  }
+  return 0;
+}
+
+std::vector<FoundType> FromSysfsTypes() {
+  std::vector<FoundType> types;
+#if SAFESIDE_LINUX
+  const std::string root = "/sys/devices/system/cpu/types/";
+  DIR *dir = opendir(root.c_str());
+  if (!dir) {
+    return types;
+  }
+  while (dirent *entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    FoundType type;
+    type.name = name;
+    type.cpus = ParseCpuList(ReadFirstLine(root + name + "/cpulist"));
+    type.speed = SpeedFromName(name);
+    if (!type.cpus.empty()) {
+      types.push_back(type);
+    }
+  }
+  closedir(dir);
+#endif
+  return types;
+}
+
+std::vector<FoundType> FromHybridPmus() {
+  std::vector<FoundType> types;
+  for (const char *name : {"cpu_core", "cpu_atom"}) {
+    FoundType type;
+    type.name = std::string("intel_") + (name + 4);
+    type.cpus = ParseCpuList(
+        ReadFirstLine(std::string("/sys/devices/") + name + "/cpus"));
+    type.speed = SpeedFromName(name);
+    if (!type.cpus.empty()) {
+      types.push_back(type);
+    }
+  }
+  return types;
+}
+
+std::vector<FoundType> FromCpuCapacity() {
+  std::map<uint64_t, FoundType> by_capacity;
+  for (int cpu : OnlineCpus()) {
+    std::string capacity = ReadFirstLine("/sys/devices/system/cpu/cpu" +
+                                         std::to_string(cpu) +
+                                         "/cpu_capacity");
+    if (capacity.empty()) {
+      return {};
+    }
+    FoundType &type = by_capacity[std::stoull(capacity)];
+    type.name = "capacity " + capacity;
+    type.speed = std::stoull(capacity);
+    type.cpus.push_back(cpu);
+  }
+  std::vector<FoundType> types;
+  for (const auto &entry : by_capacity) {
+    types.push_back(entry.second);
+  }
+  return types;
+}
+
+#if (SAFESIDE_X64 || SAFESIDE_IA32) && SAFESIDE_LINUX
+void Cpuid(unsigned int leaf, unsigned int registers[4]) {
+#  if SAFESIDE_MSVC
+  __cpuidex(reinterpret_cast<int *>(registers), leaf, 0);
+#  else
+  __cpuid_count(leaf, 0, registers[0], registers[1], registers[2],
+                registers[3]);
+#  endif
+}
+
+// CPUID leaf 0x1A describes only the CPU that executes it, so we run it from
+// a helper thread pinned to each CPU in turn.
+std::vector<FoundType> FromCpuid() {
+  unsigned int registers[4];
+  Cpuid(0, registers);
+  if (registers[0] < 0x1A) {
+    return {};
+  }
+  // The hybrid flag, CPUID.(EAX=07H,ECX=0):EDX[15].
+  Cpuid(7, registers);
+  if (!((registers[3] >> 15) & 1)) {
+    return {};
+  }
+
+  std::map<unsigned int, FoundType> by_type;
+  for (int cpu : OnlineCpus()) {
+    unsigned int core_type = 0;
+    std::thread([cpu, &core_type]() {
+      if (PinCurrentThreadToCpu(cpu)) {
+        unsigned int leaf[4];
+        Cpuid(0x1A, leaf);
+        core_type = leaf[0] >> 24;
+      }
+    }).join();
+    if (core_type == 0) {
+      return {};
+    }
+    FoundType &type = by_type[core_type];
+    type.name = core_type == 0x40   ? "intel_core"
+                : core_type == 0x20 ? "intel_atom"
+                                    : "type " + std::to_string(core_type);
+    type.speed = SpeedFromName(type.name);
+    type.cpus.push_back(cpu);
+  }
+  std::vector<FoundType> types;
+  for (const auto &entry : by_type) {
+    types.push_back(entry.second);
+  }
+  return types;
+}
+#else
+std::vector<FoundType> FromCpuid() { return {}; }
+#endif
+
+struct CoreTypeTable {
+  std::vector<int> types;
+  std::vector<std::string> names;
+};
+
+CoreTypeTable BuildTable() {
+  std::vector<FoundType> found = FromSysfsTypes();
+  if (found.size() < 2) {
+    found = FromHybridPmus();
+  }
+  if (found.size() < 2) {
+    found = FromCpuCapacity();
+  }
+  if (found.size() < 2) {
+    found = FromCpuid();
+  }
+
+  CoreTypeTable table;
+  if (found.size() < 2) {
+    table.names.push_back("");
+    return table;
+  }
+  std::stable_sort(found.begin(), found.end(),
+                   [](const FoundType &a, const FoundType &b) {
+                     return a.speed > b.speed;
+                   });
+  for (size_t type = 0; type < found.size(); ++type) {
+    table.names.push_back(found[type].name);
+    for (int cpu : found[type].cpus) {
+      if (table.types.size() <= static_cast<size_t>(cpu)) {
+        table.types.resize(cpu + 1, 0);
+      }
+      table.types[cpu] = type;
+    }
+  }
+  return table;
+}
+
+const CoreTypeTable &Table() {
+  static const CoreTypeTable table = BuildTable();
+  return table;
+}
+
+}  // namespace
+
+const std::vector<int> &CoreTypes() { return Table().types; }
+
+int CoreTypeCount() { return Table().names.size(); }
+
+std::string CoreTypeName(int type) {
+  const CoreTypeTable &table = Table();
+  if (type < 0 || static_cast<size_t>(type) >= table.names.size()) {
+    return "";
+  }
+  return table.names[type];
+}
+
+int CoreTypeOfCpu(int cpu) {
+  const std::vector<int> &types = CoreTypes();
+  if (cpu < 0 || static_cast<size_t>(cpu) >= types.size()) {
+    return 0;
+  }
+  return types[cpu];
+}
+
+int CurrentCoreType() { return CoreTypeOfCpu(CurrentCpu()); }
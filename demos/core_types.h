@@ -0,0 +1,47 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_CORE_TYPES_H_
+#define DEMOS_CORE_TYPES_H_
+
+#include <string>
+#include <vector>
+
+// Core types of hybrid processors, e.g. the P-cores and E-cores of Intel
+// Alder Lake or the big and LITTLE clusters of ARM SoCs. Cores of different
+// types have different caches and latencies, so anything calibrated on one
+// type (see TimingArray) has to be redone for the others.
+//
+// Core types are numbered by speed, 0 being the fastest. On processors with a
+// single core type, or when we can't tell, every CPU is of type 0.
+//
+// The types are read, in order of preference, from:
+//   - /sys/devices/system/cpu/types/<type>/cpulist,
+//   - the hybrid PMUs at /sys/devices/cpu_core/cpus and
+//     /sys/devices/cpu_atom/cpus,
+//   - /sys/devices/system/cpu/cpu<n>/cpu_capacity (ARM),
+//   - CPUID leaf 0x1A, executed on every CPU in turn (x86 under Linux).
+
+// Returns the core type of every CPU, indexed by CPU number. Computed once.
+const std::vector<int> &CoreTypes();
+
+// Returns the number of distinct core types, at least 1.
+int CoreTypeCount();
+
+// Returns a name for `type`, e.g. "intel_core" or "capacity 1024". Empty if
+// there is a single type.
+std::string CoreTypeName(int type);
+
+// Returns the core type of `cpu`, 0 if unknown.
+int CoreTypeOfCpu(int cpu);
+
+// Returns the core type the calling thread is running on, 0 if unknown.
+int CurrentCoreType();
+
+#endif  // DEMOS_CORE_TYPES_H_
@@ -0,0 +1,385 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * Measures the bandwidth of TimingArray as a FLUSH+RELOAD covert channel,
+ * i.e. without any speculative gadget: a sender deliberately touches one of
+ * the 256 elements and a receiver finds out which. That gives an upper bound
+ * on what any leak built on this channel can achieve on the host.
+ *
+ * Sender and receiver are either two threads or two processes. Processes share
+ * the TimingArray through copy-on-write pages inherited from `fork()`: the
+ * array is written once before forking and only read afterwards, so both
+ * processes keep mapping the same physical memory.
+ *
+ * Framing and clock recovery: the sender holds each symbol for a fixed time
+ * slot. The top bit of every symbol toggles from one symbol to the next, so
+ * the receiver, which doesn't share a clock with the sender, recognizes symbol
+ * boundaries by the toggle alone. Within a slot the receiver usually observes
+ * the symbol several times and takes a majority vote. The remaining 7 bits
+ * carry a Hamming(7,4) codeword, which corrects any single wrong bit.
+ *
+ * Reported per slot length:
+ *   - raw: the 7 codeword bits per symbol and the fraction of them that
+ *     arrived wrong (dropped and spurious symbols count as all-wrong)
+ *   - corrected: the 4 data bits per symbol that decoded correctly, and the
+ *     fraction of symbols that still decoded wrong
+ * Rates divide by the transfer time the sender measured, so descheduled or
+ * overrunning slots lower them.
+ *
+ * Usage:
+ *     covert_channel_benchmark [--mode=threads|processes]
+ *                              [--placement=sibling|core]
+ *                              [--bytes=<n>] [--slot-us=<n>[,<n>...]]
+ **/
+
+#include "compiler_specifics.h"
+
+#if !SAFESIDE_LINUX
+#  error Unsupported OS. Linux required.
+#endif
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpu_isolation.h"
+#include "instr.h"
+#include "timing_array.h"
+#include "utils.h"
+
+namespace {
+
+// Bit positions follow the classic layout p1 p2 d1 p3 d2 d3 d4, so the
+// syndrome of a single-bit error is the 1-based position of that bit.
+int Hamming74Encode(int nibble) {
+  int d1 = (nibble >> 0) & 1, d2 = (nibble >> 1) & 1;
+  int d3 = (nibble >> 2) & 1, d4 = (nibble >> 3) & 1;
+  int p1 = d1 ^ d2 ^ d4, p2 = d1 ^ d3 ^ d4, p3 = d2 ^ d3 ^ d4;
+  return p1 | (p2 << 1) | (d1 << 2) | (p3 << 3) | (d2 << 4) | (d3 << 5) |
+         (d4 << 6);
+}
+
+int Hamming74Decode(int codeword) {
+  auto bit = [codeword](int position) {
+    return (codeword >> (position - 1)) & 1;
+  };
+  int syndrome = (bit(1) ^ bit(3) ^ bit(5) ^ bit(7)) |
+                 ((bit(2) ^ bit(3) ^ bit(6) ^ bit(7)) << 1) |
+                 ((bit(4) ^ bit(5) ^ bit(6) ^ bit(7)) << 2);
+  if (syndrome != 0) {
+    codeword ^= 1 << (syndrome - 1);
+  }
+  return ((codeword >> 2) & 1) | (((codeword >> 4) & 1) << 1) |
+         (((codeword >> 5) & 1) << 2) | (((codeword >> 6) & 1) << 3);
+}
+
+int PopCount(int x) {
+  int count = 0;
+  for (; x; x &= x - 1) {
+    ++count;
+  }
+  return count;
+}
+
+// Converts a message into channel symbols, two per byte.
+std::vector<int> Encode(const std::vector<int> &message) {
+  std::vector<int> symbols;
+  for (int byte : message) {
+    for (int nibble : {byte & 0xF, byte >> 4}) {
+      int toggle = (symbols.size() & 1) << 7;
+      symbols.push_back(toggle | Hamming74Encode(nibble));
+    }
+  }
+  return symbols;
+}
+
+// Returns the number of timestamp counter ticks per microsecond.
+double TicksPerMicrosecond() {
+  auto wall_start = std::chrono::steady_clock::now();
+  uint64_t ticks_start = ReadTimestampCounter();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  uint64_t ticks = ReadTimestampCounter() - ticks_start;
+  std::chrono::duration<double, std::micro> elapsed =
+      std::chrono::steady_clock::now() - wall_start;
+  return ticks / elapsed.count();
+}
+
+// Returns the ticks the whole transfer took, which is more than the slots
+// add up to if the sender was descheduled or its slots overran.
+uint64_t Send(TimingArray &timing_array, const std::vector<int> &symbols,
+              uint64_t slot_ticks) {
+  uint64_t transfer_start = ReadTimestampCounter();
+  for (int symbol : symbols) {
+    uint64_t start = ReadTimestampCounter();
+    while (ReadTimestampCounter() - start < slot_ticks) {
+      ForceRead(&timing_array[symbol]);
+    }
+  }
+  return ReadTimestampCounter() - transfer_start;
+}
+
+// Receives up to `expected` codewords (symbols with the toggle bit removed).
+// Gives up `timeout_ticks` after starting, or after a silence of
+// `idle_ticks` once anything has been received.
+std::vector<int> Receive(TimingArray &timing_array, size_t expected,
+                         uint64_t idle_ticks, uint64_t timeout_ticks) {
+  std::vector<int> received;
+  std::array<int, 128> votes = {};
+  int toggle = -1;
+
+  auto close_symbol = [&]() {
+    received.push_back(static_cast<int>(
+        std::max_element(votes.begin(), votes.end()) - votes.begin()));
+    votes.fill(0);
+  };
+
+  uint64_t start = ReadTimestampCounter();
+  uint64_t last_hit = start;
+  while (received.size() < expected) {
+    uint64_t now = ReadTimestampCounter();
+    if (now - start > timeout_ticks) {
+      break;
+    }
+    if (toggle != -1 && now - last_hit > idle_ticks) {
+      // The sender went quiet; the last symbol is complete.
+      close_symbol();
+      toggle = -1;
+      continue;
+    }
+
+    timing_array.FlushFromCache();
+    int symbol = timing_array.FindFirstCachedElementIndex();
+    if (symbol == -1) {
+      continue;
+    }
+    last_hit = ReadTimestampCounter();
+
+    if ((symbol >> 7) != toggle) {
+      if (toggle != -1) {
+        close_symbol();
+      }
+      toggle = symbol >> 7;
+    }
+    ++votes[symbol & 0x7F];
+  }
+  if (toggle != -1 && received.size() < expected) {
+    close_symbol();
+  }
+  return received;
+}
+
+struct Errors {
+  size_t bit_errors = 0;     // raw codeword bits
+  size_t symbol_errors = 0;  // after Hamming decoding
+};
+
+// Aligns the received codewords with the sent ones by edit distance, since
+// the receiver can drop or duplicate symbols when it loses the clock, and
+// counts errors along the best alignment.
+Errors CountErrors(const std::vector<int> &sent,
+                   const std::vector<int> &received) {
+  const size_t kBitsPerCodeword = 7;
+  size_t n = sent.size(), m = received.size();
+  auto BitErrors = [&](size_t i, size_t j) -> size_t {
+    return PopCount((sent[i] ^ received[j]) & 0x7F);
+  };
+
+  // cost[i][j]: bit errors aligning sent[0, i) with received[0, j).
+  std::vector<std::vector<size_t>> cost(n + 1, std::vector<size_t>(m + 1));
+  for (size_t i = 0; i <= n; ++i) cost[i][0] = i * kBitsPerCodeword;
+  for (size_t j = 0; j <= m; ++j) cost[0][j] = j * kBitsPerCodeword;
+  for (size_t i = 1; i <= n; ++i) {
+    for (size_t j = 1; j <= m; ++j) {
+      cost[i][j] = std::min({cost[i - 1][j - 1] + BitErrors(i - 1, j - 1),
+                             cost[i - 1][j] + kBitsPerCodeword,
+                             cost[i][j - 1] + kBitsPerCodeword});
+    }
+  }
+
+  Errors errors;
+  errors.bit_errors = cost[n][m];
+
+  // Walk the alignment back to count symbols that decode wrong.
+  size_t i = n, j = m;
+  while (i > 0 || j > 0) {
+    if (i > 0 && j > 0 &&
+        cost[i][j] == cost[i - 1][j - 1] + BitErrors(i - 1, j - 1)) {
+      if (Hamming74Decode(sent[i - 1] & 0x7F) !=
+          Hamming74Decode(received[j - 1])) {
+        ++errors.symbol_errors;
+      }
+      --i;
+      --j;
+    } else if (i > 0 && cost[i][j] == cost[i - 1][j] + kBitsPerCodeword) {
+      ++errors.symbol_errors;
+      --i;
+    } else {
+      ++errors.symbol_errors;
+      --j;
+    }
+  }
+  return errors;
+}
+
+// Returns the value of `--name=value` if `arg` is that flag.
+bool FlagValue(const std::string &arg, const std::string &name,
+               std::string *value) {
+  std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  bool processes = false;
+  bool sibling = true;
+  int bytes = 256;
+  std::vector<int> slots_us = {400, 200, 100, 50, 25};
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i], value;
+    if (FlagValue(arg, "mode", &value) &&
+        (value == "threads" || value == "processes")) {
+      processes = value == "processes";
+    } else if (FlagValue(arg, "placement", &value) &&
+               (value == "sibling" || value == "core")) {
+      sibling = value == "sibling";
+    } else if (FlagValue(arg, "bytes", &value)) {
+      bytes = std::atoi(value.c_str());
+    } else if (FlagValue(arg, "slot-us", &value)) {
+      slots_us.clear();
+      std::stringstream list(value);
+      std::string slot;
+      while (std::getline(list, slot, ',')) {
+        slots_us.push_back(std::atoi(slot.c_str()));
+      }
+    } else {
+      std::cerr << "Unknown argument " << arg << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // The receiver runs on the isolated core. Pick the sender's CPU relative to
+  // it: an SMT sibling, or any CPU on another physical core.
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+  int sender_cpu = -1;
+  if (sibling && !isolation.siblings().empty()) {
+    sender_cpu = isolation.siblings()[0];
+  } else if (isolation.pinned()) {
+    // Not AllowedCpus(), which holds only the receiver's CPU once pinned.
+    sender_cpu = DistantCpu(isolation.cpu());
+  }
+  if (sender_cpu == -1) {
+    std::cout << "No CPU available for the sender; it will share the "
+                 "receiver's CPU." << std::endl;
+  } else {
+    std::cout << "Sender on CPU " << sender_cpu << " ("
+              << (sibling && !isolation.siblings().empty() ? "SMT sibling"
+                                                           : "other core")
+              << "), " << (processes ? "separate process" : "thread")
+              << std::endl;
+  }
+
+  std::vector<int> message;
+  for (int i = 0; i < bytes; ++i) {
+    message.push_back(rand() & 0xFF);
+  }
+  std::vector<int> symbols = Encode(message);
+  std::vector<int> codewords;
+  for (int symbol : symbols) {
+    codewords.push_back(symbol & 0x7F);
+  }
+
+  TimingArray timing_array;
+  double ticks_per_us = TicksPerMicrosecond();
+
+  // Where the sender reports how long the transfer took. Shared, so that a
+  // sender process can write it too.
+  void *shared = mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    std::cerr << "Failed to map memory shared with the sender" << std::endl;
+    return EXIT_FAILURE;
+  }
+  volatile uint64_t *transfer_ticks = static_cast<uint64_t *>(shared);
+
+  std::cout << std::setw(8) << "slot us" << std::setw(14) << "raw kbit/s"
+            << std::setw(14) << "raw BER" << std::setw(16) << "fixed kbit/s"
+            << std::setw(16) << "symbol errors" << std::endl;
+
+  for (int slot_us : slots_us) {
+    uint64_t slot_ticks = slot_us * ticks_per_us;
+    // Let the receiver get going before the first symbol.
+    const auto sender_delay = std::chrono::milliseconds(20);
+
+    auto sender = [&]() {
+      if (sender_cpu != -1) {
+        PinCurrentThreadToCpu(sender_cpu);
+      }
+      std::this_thread::sleep_for(sender_delay);
+      *transfer_ticks = Send(timing_array, symbols, slot_ticks);
+    };
+
+    std::thread sender_thread;
+    pid_t sender_pid = 0;
+    if (processes) {
+      sender_pid = fork();
+      if (sender_pid == 0) {
+        sender();
+        _exit(EXIT_SUCCESS);
+      }
+    } else {
+      sender_thread = std::thread(sender);
+    }
+
+    uint64_t expected_ticks = symbols.size() * slot_ticks;
+    std::vector<int> received =
+        Receive(timing_array, symbols.size(), 8 * slot_ticks,
+                2 * expected_ticks + 1000000 * ticks_per_us);
+
+    if (processes) {
+      waitpid(sender_pid, nullptr, 0);
+    } else {
+      sender_thread.join();
+    }
+
+    Errors errors = CountErrors(codewords, received);
+    double seconds = *transfer_ticks / ticks_per_us / 1e6;
+    double raw_bits = 7.0 * symbols.size();
+    double correct_bits =
+        4.0 * (symbols.size() - std::min(errors.symbol_errors, symbols.size()));
+
+    std::cout << std::setw(8) << slot_us << std::fixed << std::setprecision(2)
+              << std::setw(14) << raw_bits / seconds / 1000
+              << std::setprecision(4) << std::setw(14)
+              << errors.bit_errors / raw_bits << std::setprecision(2)
+              << std::setw(16) << correct_bits / seconds / 1000
+              << std::setprecision(4) << std::setw(16)
+              << static_cast<double>(errors.symbol_errors) / symbols.size()
+              << std::endl;
+  }
+}
@@ -0,0 +1,348 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "cpu_isolation.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX
+#  include <sched.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "asm/measurereadlatency.h"
+#include "core_types.h"
+#include "instr.h"
+#include "numa.h"
+#include "utils.h"
+
+namespace {
+
+// Busy and total jiffies for one CPU as reported by /proc/stat.
+struct CpuTimes {
+  uint64_t busy = 0;
+  uint64_t total = 0;
+};
+
+std::map<int, CpuTimes> ReadProcStat() {
+  std::map<int, CpuTimes> times;
+  std::ifstream in("/proc/stat");
+  std::string line;
+  while (std::getline(in, line)) {
+    // Skip the aggregate "cpu " line and everything that isn't a CPU.
+    if (line.compare(0, 3, "cpu") != 0 || line.size() < 4 || line[3] == ' ') {
+      continue;
+    }
+    std::stringstream ss(line.substr(3));
+    int cpu;
+    ss >> cpu;
+
+    // Fields: user nice system idle iowait irq softirq steal [guest ...].
+    // Guest time is already accounted in user and nice, so stop at steal.
+    CpuTimes t;
+    uint64_t value;
+    for (int field = 0; field < 8 && ss >> value; ++field) {
+      t.total += value;
+      if (field != 3 && field != 4) {  // idle, iowait
+        t.busy += value;
+      }
+    }
+    times[cpu] = t;
+  }
+  return times;
+}
+
+// Tells the core we're in a spin loop. On x86 this is PAUSE, which also stops
+// the spinning thread from competing with its SMT sibling for execution
+// resources.
+inline void CpuRelax() {
+#if SAFESIDE_X64 || SAFESIDE_IA32
+  _mm_pause();
+#elif SAFESIDE_ARM64 && SAFESIDE_GNUC
+  asm volatile("yield");
+#elif SAFESIDE_PPC && SAFESIDE_GNUC
+  // Set low SMT thread priority.
+  asm volatile("or 1, 1, 1");
+#endif
+}
+
+}  // namespace
+
+std::vector<int> ParseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    int first, last;
+    char dash;
+    std::stringstream rs(range);
+    if (!(rs >> first)) {
+      continue;
+    }
+    if (rs >> dash >> last) {
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    } else {
+      cpus.push_back(first);
+    }
+  }
+  return cpus;
+}
+
+std::string ReadFirstLine(const std::string &path) {
+  std::ifstream in(path);
+  std::string line;
+  std::getline(in, line);
+  return line;
+}
+
+std::vector<int> AllowedCpus() {
+  std::vector<int> cpus;
+#if SAFESIDE_LINUX
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  return cpus;
+}
+
+std::vector<int> IsolatedCpus() {
+  return ParseCpuList(ReadFirstLine("/sys/devices/system/cpu/isolated"));
+}
+
+std::vector<int> SiblingCpus(int cpu) {
+  std::vector<int> siblings = ParseCpuList(ReadFirstLine(
+      "/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+      "/topology/thread_siblings_list"));
+  siblings.erase(std::remove(siblings.begin(), siblings.end(), cpu),
+                 siblings.end());
+  return siblings;
+}
+
+std::vector<int> OnlineCpus() {
+  return ParseCpuList(ReadFirstLine("/sys/devices/system/cpu/online"));
+}
+
+int DistantCpu(int cpu) {
+  std::vector<int> core = SiblingCpus(cpu);
+  core.push_back(cpu);
+  std::vector<int> isolated = IsolatedCpus();
+  int distant = -1;
+  for (int candidate : OnlineCpus()) {
+    if (std::find(core.begin(), core.end(), candidate) != core.end()) {
+      continue;
+    }
+    if (std::find(isolated.begin(), isolated.end(), candidate) !=
+        isolated.end()) {
+      return candidate;
+    }
+    if (distant == -1) {
+      distant = candidate;
+    }
+  }
+  return distant;
+}
+
+int CurrentCpu() {
+#if SAFESIDE_LINUX
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+bool PinCurrentThreadToCpu(int cpu) {
+#if SAFESIDE_LINUX
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  // A pid of 0 means the calling thread, not the whole process.
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
+
+std::vector<double> SampleCpuLoads(int interval_ms) {
+  std::map<int, CpuTimes> before = ReadProcStat();
+  std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+  std::map<int, CpuTimes> after = ReadProcStat();
+
+  std::vector<double> loads;
+  for (const auto &entry : after) {
+    auto it = before.find(entry.first);
+    if (it == before.end()) {
+      continue;
+    }
+    uint64_t total = entry.second.total - it->second.total;
+    uint64_t busy = entry.second.busy - it->second.busy;
+    if (loads.size() <= static_cast<size_t>(entry.first)) {
+      loads.resize(entry.first + 1);
+    }
+    loads[entry.first] = total == 0 ? 0.0 : static_cast<double>(busy) / total;
+  }
+  return loads;
+}
+
+double MeasureTimingNoise() {
+  const int samples = 10000;
+  char line = 0;
+  std::vector<uint64_t> latencies;
+  latencies.reserve(samples);
+
+  for (int i = 0; i < samples; ++i) {
+    ForceRead(&line);
+    latencies.push_back(MeasureReadLatency(&line));
+  }
+
+  std::vector<uint64_t> sorted(latencies);
+  std::sort(sorted.begin(), sorted.end());
+  uint64_t median = sorted[samples / 2];
+
+  int outliers = 0;
+  for (uint64_t latency : latencies) {
+    if (latency > 2 * median) {
+      ++outliers;
+    }
+  }
+  return static_cast<double>(outliers) / samples;
+}
+
+CpuIsolation::CpuIsolation(bool park_siblings, bool prefer_fast_cores) {
+  // 100ms is enough for /proc/stat, which counts in jiffies (usually 1-10ms),
+  // to tell an idle core from a busy one.
+  const int load_sample_interval_ms = 100;
+
+  std::vector<int> candidates = AllowedCpus();
+  std::vector<int> isolated = IsolatedCpus();
+  std::vector<int> allowed_isolated;
+  for (int cpu : candidates) {
+    if (std::find(isolated.begin(), isolated.end(), cpu) != isolated.end()) {
+      allowed_isolated.push_back(cpu);
+    }
+  }
+  if (!allowed_isolated.empty()) {
+    candidates = allowed_isolated;
+  }
+  if (prefer_fast_cores && CoreTypeCount() > 1) {
+    std::vector<int> fast;
+    for (int cpu : candidates) {
+      if (CoreTypeOfCpu(cpu) == 0) {
+        fast.push_back(cpu);
+      }
+    }
+    if (!fast.empty()) {
+      candidates = fast;
+    }
+  }
+  if (candidates.empty()) {
+    noise_score_ = MeasureTimingNoise();
+    return;
+  }
+
+  std::vector<double> loads = SampleCpuLoads(load_sample_interval_ms);
+  auto load_of = [&loads](int cpu) {
+    return static_cast<size_t>(cpu) < loads.size() ? loads[cpu] : 0.0;
+  };
+
+  // Score each candidate by the load of its whole physical core. Ties go to
+  // the lowest-numbered CPU, which keeps the choice stable across runs.
+  double best_score = 0;
+  for (int cpu : candidates) {
+    double score = load_of(cpu);
+    for (int sibling : SiblingCpus(cpu)) {
+      score += load_of(sibling);
+    }
+    if (cpu_ == -1 || score < best_score) {
+      best_score = score;
+      cpu_ = cpu;
+    }
+  }
+
+  pinned_ = PinCurrentThreadToCpu(cpu_);
+  if (!pinned_) {
+    cpu_ = -1;
+    noise_score_ = MeasureTimingNoise();
+    return;
+  }
+
+  core_type_ = CoreTypeOfCpu(cpu_);
+  numa_node_ = NumaNodeOfCpu(cpu_);
+  siblings_ = SiblingCpus(cpu_);
+  for (int sibling : siblings_) {
+    sibling_load_ = std::max(sibling_load_, load_of(sibling));
+  }
+
+  if (park_siblings) {
+    for (int sibling : siblings_) {
+      spinners_.emplace_back(new std::thread([this, sibling]() {
+        if (!PinCurrentThreadToCpu(sibling)) {
+          return;
+        }
+        while (!stop_spinners_.load(std::memory_order_relaxed)) {
+          CpuRelax();
+        }
+      }));
+    }
+  }
+
+  noise_score_ = MeasureTimingNoise();
+}
+
+CpuIsolation::~CpuIsolation() {
+  stop_spinners_ = true;
+  for (auto &spinner : spinners_) {
+    spinner->join();
+  }
+}
+
+void CpuIsolation::PrintReport(std::ostream &out) const {
+  // Format into a separate stream so we don't change the caller's flags.
+  std::ostringstream report;
+  report << std::fixed;
+  if (!pinned_) {
+    report << "CPU isolation: not pinned";
+  } else {
+    report << "CPU isolation: pinned to CPU " << cpu_;
+    if (CoreTypeCount() > 1) {
+      report << " (" << CoreTypeName(core_type_) << ")";
+    }
+    if (NumaNodes().size() > 1) {
+      report << " on NUMA node " << numa_node_;
+    }
+    if (!siblings_.empty()) {
+      report << ", SMT siblings";
+      for (int sibling : siblings_) {
+        report << " " << sibling;
+      }
+      report << " at " << std::setprecision(0) << sibling_load_ * 100
+             << "% load";
+      if (!spinners_.empty()) {
+        report << " (parked)";
+      }
+    }
+  }
+  report << ", noise score " << std::setprecision(4) << noise_score_;
+  out << report.str() << std::endl;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_CPU_ISOLATION_H_
+#define DEMOS_CPU_ISOLATION_H_
+
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Helpers for inspecting and controlling which CPU the current thread runs on.
+// CPUs are identified by the operating system's logical CPU number. On
+// platforms where we don't know how to do any of this, the helpers report
+// "nothing known" (empty lists, -1, false) rather than failing.
+
+// Parses the kernel's "cpulist" format, e.g. "0-3,8,10-11", as used for CPU
+// and NUMA node lists in sysfs. Returns an empty list for an empty string.
+std::vector<int> ParseCpuList(const std::string &list);
+
+// Returns the first line of the file at `path`, or an empty string.
+std::string ReadFirstLine(const std::string &path);
+
+// Returns the logical CPUs the current thread is allowed to run on.
+std::vector<int> AllowedCpus();
+
+// Returns the logical CPUs listed in /sys/devices/system/cpu/isolated, i.e.
+// those the kernel keeps general scheduling off of.
+std::vector<int> IsolatedCpus();
+
+// Returns the other hardware threads (SMT siblings) sharing a physical core
+// with `cpu`. Does not include `cpu` itself.
+std::vector<int> SiblingCpus(int cpu);
+
+// Returns the logical CPUs listed in /sys/devices/system/cpu/online. Unlike
+// AllowedCpus(), this doesn't shrink when the calling thread is pinned.
+std::vector<int> OnlineCpus();
+
+// Returns an online CPU on a different physical core than `cpu`, i.e. neither
+// `cpu` nor one of its SMT siblings, preferring isolated CPUs. Returns -1 if
+// there is none. Used to run helper threads where they share as little as
+// possible with the thread measuring on `cpu`.
+int DistantCpu(int cpu);
+
+// Returns the CPU the calling thread is currently running on, or -1.
+int CurrentCpu();
+
+// Restricts the calling thread to run only on `cpu`. Returns true on success.
+bool PinCurrentThreadToCpu(int cpu);
+
+// Samples /proc/stat twice, `interval_ms` apart, and returns the fraction of
+// that interval each CPU spent busy (0.0 to 1.0), indexed by CPU number.
+std::vector<double> SampleCpuLoads(int interval_ms);
+
+// Measures how noisy cache timing is on the current CPU: the fraction of
+// timed reads of an L1-resident line that took more than twice the median.
+// Interrupts, a busy SMT sibling and frequency changes all push this up. An
+// idle, pinned core typically scores well under 0.01.
+double MeasureTimingNoise();
+
+// CpuIsolation sets up a stable environment for measuring cache timing. On
+// construction it:
+//   - Picks a physical core, preferring CPUs isolated with `isolcpus=` and
+//     otherwise the core (all SMT siblings counted together) with the lowest
+//     recent load according to /proc/stat.
+//     On hybrid processors, only cores of the fastest type are considered
+//     unless `prefer_fast_cores` is false or none is allowed.
+//   - Pins the calling thread to a CPU on that core.
+//   - Optionally parks a spinner on each SMT sibling. The spinner only
+//     executes pause hints, so it competes very little for the core's
+//     execution resources and caches, but it keeps the scheduler from putting
+//     something noisier there.
+//   - Measures a noise score for the chosen CPU.
+//
+// Construct it at the very beginning of `main`, before any TimingArray or
+// CacheSideChannel, so that latency thresholds are calibrated on the same core
+// the leak later runs on. Pinning outlives the object; parked spinners are
+// stopped by the destructor.
+//
+// Example use:
+//
+//     int main() {
+//       CpuIsolation isolation;
+//       isolation.PrintReport(std::cout);
+//       ...
+//     }
+class CpuIsolation {
+ public:
+  explicit CpuIsolation(bool park_siblings = false,
+                        bool prefer_fast_cores = true);
+  ~CpuIsolation();
+
+  CpuIsolation(const CpuIsolation&) = delete;
+  CpuIsolation& operator=(const CpuIsolation&) = delete;
+
+  // Whether the calling thread was successfully pinned.
+  bool pinned() const { return pinned_; }
+
+  // The CPU the thread was pinned to, or -1 if pinning failed.
+  int cpu() const { return cpu_; }
+
+  // The core type of `cpu()`, see core_types.h.
+  int core_type() const { return core_type_; }
+
+  // The NUMA node of `cpu()`, where oracles are placed by default.
+  int numa_node() const { return numa_node_; }
+
+  // The SMT siblings of `cpu()`.
+  const std::vector<int>& siblings() const { return siblings_; }
+
+  // The highest load among the siblings over the sampling interval, measured
+  // before any spinner was parked on them.
+  double sibling_load() const { return sibling_load_; }
+
+  // The result of `MeasureTimingNoise()` after pinning.
+  double noise_score() const { return noise_score_; }
+
+  // Writes a one-line human-readable summary of the above.
+  void PrintReport(std::ostream& out) const;
+
+ private:
+  bool pinned_ = false;
+  int cpu_ = -1;
+  int core_type_ = 0;
+  int numa_node_ = 0;
+  std::vector<int> siblings_;
+  double sibling_load_ = 0;
+  double noise_score_ = 0;
+
+  std::atomic<bool> stop_spinners_{false};
+  std::vector<std::unique_ptr<std::thread>> spinners_;
+};
+
+#endif  // DEMOS_CPU_ISOLATION_H_
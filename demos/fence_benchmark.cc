@@ -0,0 +1,429 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * Measures the barrier candidates discussed in docs/fencing.md on the current
+ * architecture: what each one costs, and whether it actually stops
+ * speculation.
+ *
+ * Costs are in timestamp counter ticks per loop iteration (see
+ * ReadTimestampCounter), for a loop that runs the barrier:
+ *   alone        back to back, i.e. its throughput
+ *   after-load   right after a load that misses the cache
+ *   after-flush  right after flushing a cached line
+ *   after-store  right after a store
+ * The "none" row runs the same loops without a barrier, so subtract it to get
+ * the cost of the barrier itself.
+ *
+ * The speculation check puts the barrier between a mistrained bounds check
+ * and the out-of-bounds oracle access of spectre_v1_pht_sa, and counts how
+ * many rounds still leak. A barrier that stops speculation leaks in none; the
+ * "none" row shows that the gadget leaks at all on this machine.
+ *
+ * Virtualization changes the picture (CPUID, for one, usually traps to the
+ * hypervisor), so the report says whether we run under one. Run the benchmark
+ * on bare metal and in the VMs you care about to compare.
+ **/
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+#if SAFESIDE_LINUX && SAFESIDE_ARM64
+#  include <sys/auxv.h>
+#endif
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cpu_isolation.h"
+#include "hardware_constants.h"
+#include "instr.h"
+#include "timing_array.h"
+#include "utils.h"
+
+namespace {
+
+// Each candidate is a struct with a name and an inlined Run(), so that the
+// measurement templates below compile to the barrier itself rather than a
+// call. See "Other implementation notes" in docs/fencing.md.
+
+struct NoBarrier {
+  static const char *Name() { return "none"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {}
+};
+
+#if SAFESIDE_X64 || SAFESIDE_IA32
+struct MfenceLfence {
+  static const char *Name() { return "mfence+lfence"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    _mm_mfence();
+    _mm_lfence();
+  }
+};
+
+struct Lfence {
+  static const char *Name() { return "lfence"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() { _mm_lfence(); }
+};
+
+struct Mfence {
+  static const char *Name() { return "mfence"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() { _mm_mfence(); }
+};
+
+struct Cpuid {
+  static const char *Name() { return "cpuid"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+#  if SAFESIDE_MSVC
+    int registers[4];
+    __cpuid(registers, 0);
+#  else
+    unsigned int eax, ebx, ecx, edx;
+    __cpuid(0, eax, ebx, ecx, edx);
+    asm volatile("" : : "r"(eax), "r"(ebx), "r"(ecx), "r"(edx));
+#  endif
+  }
+};
+
+struct Rdtscp {
+  static const char *Name() { return "rdtscp"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    unsigned int aux;
+    __rdtscp(&aux);
+  }
+};
+
+struct RdtscpLfence {
+  static const char *Name() { return "rdtscp+lfence"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    unsigned int aux;
+    __rdtscp(&aux);
+    _mm_lfence();
+  }
+};
+#elif SAFESIDE_ARM64
+struct DsbIsb {
+  static const char *Name() { return "dsb sy+isb"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("dsb sy\nisb\n" : : : "memory");
+  }
+};
+
+struct Dsb {
+  static const char *Name() { return "dsb sy"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("dsb sy\n" : : : "memory");
+  }
+};
+
+struct Isb {
+  static const char *Name() { return "isb"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("isb\n" : : : "memory");
+  }
+};
+
+struct Dmb {
+  static const char *Name() { return "dmb sy"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("dmb sy\n" : : : "memory");
+  }
+};
+
+// The speculation barrier instruction from ARMv8.5 (FEAT_SB). Encoded by hand
+// since older assemblers don't know it.
+struct Sb {
+  static const char *Name() { return "sb"; }
+  static bool Supported() {
+#  if SAFESIDE_LINUX
+#    ifndef HWCAP_SB
+#      define HWCAP_SB (1 << 29)
+#    endif
+    return (getauxval(AT_HWCAP) & HWCAP_SB) != 0;
+#  else
+    return false;
+#  endif
+  }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile(".inst 0xd50330ff\n" : : : "memory");
+  }
+};
+#elif SAFESIDE_PPC
+struct IsyncSync {
+  static const char *Name() { return "isync+sync"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("isync\nsync\n" : : : "memory");
+  }
+};
+
+struct Sync {
+  static const char *Name() { return "sync"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("sync\n" : : : "memory");
+  }
+};
+
+struct Isync {
+  static const char *Name() { return "isync"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("isync\n" : : : "memory");
+  }
+};
+
+struct Lwsync {
+  static const char *Name() { return "lwsync"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("lwsync\n" : : : "memory");
+  }
+};
+
+// The speculation barrier that POWER firmware advertises for Spectre v1.
+struct OriBarrier {
+  static const char *Name() { return "ori 31,31,0"; }
+  static bool Supported() { return true; }
+  static SAFESIDE_ALWAYS_INLINE void Run() {
+    asm volatile("ori 31,31,0\n" : : : "memory");
+  }
+};
+#endif
+
+constexpr int kIterations = 100000;
+
+// Lines for the memory scenarios, each on its own page so that consecutive
+// iterations don't help each other through the prefetchers.
+constexpr size_t kLines = 256;
+struct alignas(kCacheLineBytes) Line {
+  std::array<char, kPageBytes> bytes;
+};
+
+enum class Scenario { kAlone, kAfterLoad, kAfterFlush, kAfterStore };
+
+template <typename Barrier>
+double MeasureTicksPerIteration(Scenario scenario, std::vector<Line> &lines) {
+  // Prepare the state each scenario expects at the start of an iteration.
+  for (Line &line : lines) {
+    if (scenario == Scenario::kAfterLoad) {
+      FlushDataCacheLineNoBarrier(&line);
+    } else {
+      ForceRead(&line);
+    }
+  }
+  MemoryAndSpeculationBarrier();
+
+  uint64_t start = ReadTimestampCounter();
+  for (int i = 0; i < kIterations; ++i) {
+    // The multiplier permutes the lines, like TimingArray does.
+    Line &line = lines[(i * 113) % kLines];
+    switch (scenario) {
+      case Scenario::kAlone:
+        break;
+      case Scenario::kAfterLoad:
+        ForceRead(&line);
+        break;
+      case Scenario::kAfterFlush:
+        FlushDataCacheLineNoBarrier(&line);
+        break;
+      case Scenario::kAfterStore:
+        *reinterpret_cast<volatile char *>(&line) = static_cast<char>(i);
+        break;
+    }
+    Barrier::Run();
+    if (scenario == Scenario::kAfterLoad) {
+      // Evict the line again for the next time around. Not timed separately,
+      // so this costs the same in every row.
+      FlushDataCacheLineNoBarrier(&line);
+    } else if (scenario == Scenario::kAfterFlush) {
+      ForceRead(&line);
+    }
+  }
+  MemoryAndSpeculationBarrier();
+  return static_cast<double>(ReadTimestampCounter() - start) / kIterations;
+}
+
+// Public data followed directly by a secret byte that is only ever read
+// speculatively, like local_content.h.
+constexpr size_t kPublicSize = 16;
+struct GadgetData {
+  char public_data[kPublicSize];
+  char secret;
+};
+GadgetData gadget_data;
+
+// Returns in how many of `rounds` rounds the spectre_v1_pht_sa gadget leaked
+// the secret with Barrier placed after its bounds check.
+template <typename Barrier>
+int SpeculativeLeaks(int rounds) {
+  memset(gadget_data.public_data, 'x', kPublicSize);
+  gadget_data.secret = 'S';
+  // Index through a plain pointer, so the compiler can neither assume the
+  // offset is in bounds nor fold the public bytes it just wrote.
+  const char *data = gadget_data.public_data;
+  const size_t secret_offset = kPublicSize;
+
+  TimingArray timing_array;
+  std::unique_ptr<size_t> size_in_heap(new size_t(kPublicSize));
+
+  int leaks = 0;
+  for (int round = 0; round < rounds; ++round) {
+    timing_array.FlushFromCache();
+    size_t safe_offset = round % kPublicSize;
+
+    for (size_t i = 0; i < 2048; ++i) {
+      FlushDataCacheLine(size_in_heap.get());
+      // Branchless equivalent of
+      //     local_offset = ((i + 1) % 2048) ? safe_offset : secret_offset;
+      // See spectre_v1_pht_sa.
+      size_t local_offset =
+          secret_offset +
+          (safe_offset - secret_offset) * static_cast<bool>((i + 1) % 2048);
+
+      if (local_offset < *size_in_heap) {
+        Barrier::Run();
+        ForceRead(&timing_array[data[local_offset]]);
+      }
+    }
+
+    if (timing_array.FindFirstCachedElementIndexAfter('x') ==
+        gadget_data.secret) {
+      ++leaks;
+    }
+  }
+  return leaks;
+}
+
+constexpr int kSpeculationRounds = 200;
+
+template <typename Barrier>
+void Measure(std::vector<Line> &lines) {
+  std::cout << std::left << std::setw(16) << Barrier::Name() << std::right;
+  if (!Barrier::Supported()) {
+    std::cout << "  not supported by this CPU" << std::endl;
+    return;
+  }
+  std::cout << std::fixed << std::setprecision(1);
+  for (Scenario scenario : {Scenario::kAlone, Scenario::kAfterLoad,
+                            Scenario::kAfterFlush, Scenario::kAfterStore}) {
+    std::cout << std::setw(13)
+              << MeasureTicksPerIteration<Barrier>(scenario, lines);
+  }
+  int leaks = SpeculativeLeaks<Barrier>(kSpeculationRounds);
+  std::cout << std::setw(12)
+            << std::to_string(leaks) + "/" + std::to_string(kSpeculationRounds)
+            << std::endl;
+}
+
+void PrintEnvironment() {
+#if SAFESIDE_X64 || SAFESIDE_IA32
+  unsigned int registers[4];
+#  if SAFESIDE_MSVC
+  __cpuid(reinterpret_cast<int *>(registers), 0);
+#  else
+  __cpuid(0, registers[0], registers[1], registers[2], registers[3]);
+#  endif
+  // The vendor string is in EBX, EDX, ECX.
+  char vendor[13] = {};
+  memcpy(vendor, &registers[1], 4);
+  memcpy(vendor + 4, &registers[3], 4);
+  memcpy(vendor + 8, &registers[2], 4);
+
+#  if SAFESIDE_MSVC
+  __cpuid(reinterpret_cast<int *>(registers), 1);
+#  else
+  __cpuid(1, registers[0], registers[1], registers[2], registers[3]);
+#  endif
+  bool hypervisor = (registers[2] >> 31) & 1;
+
+  std::cout << "CPU vendor: " << vendor
+            << ", hypervisor: " << (hypervisor ? "yes" : "no") << std::endl;
+
+  if (strcmp(vendor, "AuthenticAMD") == 0 ||
+      strcmp(vendor, "HygonGenuine") == 0) {
+    // LFENCE is only serializing on AMD if bit 1 of DE_CFG is set, see
+    // docs/fencing.md. Reading the MSR needs root and the msr module; the
+    // speculation check of the lfence row tells the same story without.
+    std::string state = "unknown";
+#  if SAFESIDE_LINUX
+    int fd = open(("/dev/cpu/" + std::to_string(CurrentCpu()) + "/msr").c_str(),
+                  O_RDONLY);
+    uint64_t de_cfg;
+    if (fd != -1 && pread(fd, &de_cfg, sizeof(de_cfg), 0xC0011029) ==
+                        sizeof(de_cfg)) {
+      state = (de_cfg & 2) ? "yes" : "no";
+    }
+    if (fd != -1) {
+      close(fd);
+    }
+#  endif
+    std::cout << "LFENCE serializing (DE_CFG[1]): " << state << std::endl;
+  }
+#endif
+}
+
+}  // namespace
+
+int main() {
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+  PrintEnvironment();
+
+  std::vector<Line> lines(kLines);
+  // Calibrate TimingArray before the table.
+  { TimingArray calibrate; }
+
+  std::cout << std::left << std::setw(16) << "barrier" << std::right
+            << std::setw(13) << "alone" << std::setw(13) << "after-load"
+            << std::setw(13) << "after-flush" << std::setw(13)
+            << "after-store" << std::setw(12) << "leaks" << std::endl;
+
+  Measure<NoBarrier>(lines);
+#if SAFESIDE_X64 || SAFESIDE_IA32
+  Measure<MfenceLfence>(lines);
+  Measure<Lfence>(lines);
+  Measure<Mfence>(lines);
+  Measure<Cpuid>(lines);
+  Measure<Rdtscp>(lines);
+  Measure<RdtscpLfence>(lines);
+#elif SAFESIDE_ARM64
+  Measure<DsbIsb>(lines);
+  Measure<Dsb>(lines);
+  Measure<Isb>(lines);
+  Measure<Dmb>(lines);
+  Measure<Sb>(lines);
+#elif SAFESIDE_PPC
+  Measure<IsyncSync>(lines);
+  Measure<Sync>(lines);
+  Measure<Isync>(lines);
+  Measure<Lwsync>(lines);
+  Measure<OriBarrier>(lines);
+#endif
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "frequency_monitor.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include "instr.h"
+
+constexpr double FrequencyMonitor::kTolerance;
+constexpr std::chrono::milliseconds FrequencyMonitor::kCheckInterval;
+
+namespace {
+
+// Times a chain of dependent multiplications and returns the fastest of a few
+// runs in timestamp ticks, i.e. the run least disturbed by interrupts. The
+// chain takes a fixed number of core cycles, so the result is inversely
+// proportional to the core frequency.
+uint64_t TimeReferenceLoop() {
+  const int iterations = 10000;
+  const int runs = 5;
+
+  static volatile uint64_t sink = 1;
+  uint64_t best = UINT64_MAX;
+  for (int run = 0; run < runs; ++run) {
+    uint64_t x = sink;
+    MemoryAndSpeculationBarrier();
+    uint64_t start = ReadTimestampCounter();
+    for (int i = 0; i < iterations; ++i) {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    sink = x;
+    MemoryAndSpeculationBarrier();
+    best = std::min(best, ReadTimestampCounter() - start);
+  }
+  return std::max<uint64_t>(best, 1);
+}
+
+#if SAFESIDE_LINUX
+int OpenCounter(uint64_t config) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  // Counting user mode only needs the least privileges.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+uint64_t ReadCounter(int fd) {
+  uint64_t value = 0;
+  if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+    return 0;
+  }
+  return value;
+}
+#endif
+
+}  // namespace
+
+FrequencyMonitor::FrequencyMonitor() {
+#if SAFESIDE_LINUX
+  cycles_fd_ = OpenCounter(PERF_COUNT_HW_CPU_CYCLES);
+  ref_cycles_fd_ = OpenCounter(PERF_COUNT_HW_REF_CPU_CYCLES);
+  if (cycles_fd_ < 0 || ref_cycles_fd_ < 0) {
+    if (cycles_fd_ >= 0) {
+      close(cycles_fd_);
+    }
+    if (ref_cycles_fd_ >= 0) {
+      close(ref_cycles_fd_);
+    }
+    cycles_fd_ = ref_cycles_fd_ = -1;
+  }
+#endif
+
+  WarmUp();
+  MeasureFrequency();  // Starts the perf event interval.
+  TimeReferenceLoop();
+  baseline_ = reference_ = MeasureFrequency();
+  // Virtual machines sometimes expose the counters without counting.
+  if (uses_perf_events() && baseline_ == 0) {
+#if SAFESIDE_LINUX
+    close(cycles_fd_);
+    close(ref_cycles_fd_);
+#endif
+    cycles_fd_ = ref_cycles_fd_ = -1;
+    baseline_ = reference_ = MeasureFrequency();
+  }
+  last_check_ = std::chrono::steady_clock::now();
+}
+
+FrequencyMonitor::~FrequencyMonitor() {
+#if SAFESIDE_LINUX
+  if (uses_perf_events()) {
+    close(cycles_fd_);
+    close(ref_cycles_fd_);
+  }
+#endif
+}
+
+void FrequencyMonitor::WarmUp(int max_ms) {
+  // Ramping up takes a few milliseconds on recent CPUs and tens on older
+  // ones. We are done when two consecutive timings agree to 1%.
+  auto start = std::chrono::steady_clock::now();
+  uint64_t previous = TimeReferenceLoop();
+  while (std::chrono::steady_clock::now() - start <
+         std::chrono::milliseconds(max_ms)) {
+    uint64_t ticks = TimeReferenceLoop();
+    if (std::chrono::steady_clock::now() - start >
+            std::chrono::milliseconds(10) &&
+        std::abs(static_cast<double>(ticks) - previous) < previous / 100.0) {
+      return;
+    }
+    previous = ticks;
+  }
+}
+
+double FrequencyMonitor::MeasureFrequency() {
+#if SAFESIDE_LINUX
+  if (uses_perf_events()) {
+    uint64_t cycles = ReadCounter(cycles_fd_);
+    uint64_t ref_cycles = ReadCounter(ref_cycles_fd_);
+    uint64_t delta_cycles = cycles - last_cycles_;
+    uint64_t delta_ref_cycles = ref_cycles - last_ref_cycles_;
+    last_cycles_ = cycles;
+    last_ref_cycles_ = ref_cycles;
+    if (delta_ref_cycles == 0) {
+      return 0;
+    }
+    return static_cast<double>(delta_cycles) / delta_ref_cycles;
+  }
+#endif
+  return 1.0 / TimeReferenceLoop();
+}
+
+bool FrequencyMonitor::Update() {
+  auto now = std::chrono::steady_clock::now();
+  if (now - last_check_ < kCheckInterval) {
+    return false;
+  }
+  last_check_ = now;
+
+  double frequency = MeasureFrequency();
+  if (frequency <= 0) {
+    return false;
+  }
+  relative_frequency_ = frequency / baseline_;
+  if (std::abs(frequency - reference_) <= kTolerance * reference_) {
+    return false;
+  }
+  reference_ = frequency;
+  ++generation_;
+  return true;
+}
+
+void FrequencyMonitor::PrintReport(std::ostream &out) const {
+  // Format into a separate stream so we don't change the caller's flags.
+  std::ostringstream report;
+  report << "Frequency monitor: "
+         << (uses_perf_events() ? "perf events" : "reference loop") << ", "
+         << std::fixed << std::setprecision(2) << relative_frequency_
+         << "x baseline, " << generation_ << " shifts";
+  out << report.str() << std::endl;
+}
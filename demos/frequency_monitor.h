@@ -0,0 +1,95 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_FREQUENCY_MONITOR_H_
+#define DEMOS_FREQUENCY_MONITOR_H_
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// FrequencyMonitor tracks the core clock while a leak runs. On x86,
+// MeasureReadLatency counts timestamp ticks, which run at a constant rate
+// while the core clock follows turbo and power states. A cache hit takes a
+// fixed number of core cycles, so in timestamp ticks it gets slower when the
+// core clocks down, and a threshold calibrated at startup goes stale.
+//
+// The core clock relative to the timestamp counter is measured either with
+// the cycles and ref-cycles perf events (the APERF/MPERF ratio, on Linux when
+// perf_event_open allows it) or by timing a fixed chain of dependent
+// multiplications.
+//
+// Attach a monitor to a TimingArray with SetFrequencyMonitor. Scans then call
+// Update(), and when it detects a frequency shift the TimingArray recalibrates
+// and reports no cached element (-1) for that scan, so callers simply retry.
+// A monitor may be attached to several TimingArrays but, like
+// InterruptDetector, is not thread-safe.
+//
+// Example use:
+//
+//     CpuIsolation isolation;
+//     FrequencyMonitor frequency_monitor;  // Warms up before calibration.
+//     TimingArray timing_array;
+//     timing_array.SetFrequencyMonitor(&frequency_monitor);
+class FrequencyMonitor {
+ public:
+  // Warms the core up and records the baseline frequency.
+  FrequencyMonitor();
+  ~FrequencyMonitor();
+
+  FrequencyMonitor(const FrequencyMonitor&) = delete;
+  FrequencyMonitor& operator=(const FrequencyMonitor&) = delete;
+
+  // Keeps the core busy until its clock stops ramping up, for at most
+  // `max_ms` milliseconds. Calibrating on a core that is still coming out of
+  // a power-saving state yields thresholds that are too high.
+  static void WarmUp(int max_ms = 200);
+
+  // Measures the frequency if the last measurement is older than the check
+  // interval. If it moved by more than the tolerance from the frequency of
+  // the last shift, takes it as the new reference and increments
+  // generation(). Returns true if it did.
+  bool Update();
+
+  // Number of frequency shifts seen so far. Anything calibrated at an older
+  // generation is stale.
+  uint64_t generation() const { return generation_; }
+
+  // The last measured core frequency relative to the baseline, e.g. 0.8 when
+  // the core runs 20% slower than when the monitor was constructed.
+  double relative_frequency() const { return relative_frequency_; }
+
+  // Whether the perf events are used, as opposed to the reference loop.
+  bool uses_perf_events() const { return cycles_fd_ >= 0; }
+
+  // Writes a one-line human-readable summary of the above.
+  void PrintReport(std::ostream& out) const;
+
+ private:
+  // Frequency shifts smaller than this are ignored.
+  static constexpr double kTolerance = 0.05;
+  // How often Update() measures.
+  static constexpr std::chrono::milliseconds kCheckInterval{10};
+
+  // Returns a quantity proportional to the core frequency.
+  double MeasureFrequency();
+
+  int cycles_fd_ = -1;
+  int ref_cycles_fd_ = -1;
+  uint64_t last_cycles_ = 0;
+  uint64_t last_ref_cycles_ = 0;
+
+  double baseline_ = 0;
+  double reference_ = 0;
+  double relative_frequency_ = 1;
+  uint64_t generation_ = 0;
+  std::chrono::steady_clock::time_point last_check_;
+};
+
+#endif  // DEMOS_FREQUENCY_MONITOR_H_
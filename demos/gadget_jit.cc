@@ -0,0 +1,225 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "gadget_jit.h"
+
+#include "compiler_specifics.h"
+
+#if (SAFESIDE_LINUX || SAFESIDE_MAC) && (SAFESIDE_X64 || SAFESIDE_ARM64)
+#  define SAFESIDE_GADGET_JIT 1
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+namespace {
+
+#if SAFESIDE_GADGET_JIT && SAFESIDE_X64
+
+// Emits the loop for the System V calling convention:
+//     rdi = data, rsi = size, rdx = oracle, rcx = safe_offset,
+//     r8 = attack_offset, r9 = iterations
+// Uses rax as the loop counter and r10, r11 as scratch registers.
+void Emit(size_t alignment, size_t branch_offset, std::vector<uint8_t> *code,
+          size_t *branch_position) {
+  auto emit = [code](std::initializer_list<uint8_t> bytes) {
+    code->insert(code->end(), bytes.begin(), bytes.end());
+  };
+  auto emit32 = [code](int32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      code->push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  };
+
+  // Instructions between the loop label and the bounds check branch.
+  const size_t kLoopToBranchBytes = 26;
+
+  emit({0x31, 0xC0});  // xor eax, eax
+
+  // The loop below tests at the bottom, so skip it for zero iterations.
+  emit({0x4D, 0x85, 0xC9});  // test r9, r9
+  emit({0x0F, 0x84});        // je done
+  size_t skip_loop = code->size();
+  emit32(0);
+
+  // Pad so the branch lands at branch_offset, with the recommended multi-byte
+  // NOPs. The padding runs once, before the loop.
+  size_t padding = (branch_offset + alignment -
+                    (code->size() + kLoopToBranchBytes) % alignment) %
+                   alignment;
+  static const uint8_t kNops[9][9] = {
+      {0x90},
+      {0x66, 0x90},
+      {0x0F, 0x1F, 0x00},
+      {0x0F, 0x1F, 0x40, 0x00},
+      {0x0F, 0x1F, 0x44, 0x00, 0x00},
+      {0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00},
+      {0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00},
+      {0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+      {0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+  };
+  while (padding > 0) {
+    size_t length = padding < 9 ? padding : 9;
+    code->insert(code->end(), kNops[length - 1], kNops[length - 1] + length);
+    padding -= length;
+  }
+
+  size_t loop = code->size();
+  emit({0x0F, 0xAE, 0x3E});        // clflush [rsi]
+  emit({0x0F, 0xAE, 0xF0});        // mfence
+  emit({0x0F, 0xAE, 0xE8});        // lfence
+  emit({0x4C, 0x8D, 0x50, 0x01});  // lea r10, [rax + 1]
+  emit({0x49, 0x89, 0xCB});        // mov r11, rcx
+  emit({0x4D, 0x39, 0xCA});        // cmp r10, r9
+  emit({0x4D, 0x0F, 0x44, 0xD8});  // cmove r11, r8
+  emit({0x4C, 0x3B, 0x1E});        // cmp r11, [rsi]
+
+  *branch_position = code->size();
+  emit({0x0F, 0x83});  // jae skip
+  emit32(12);
+  emit({0x46, 0x0F, 0xB6, 0x14, 0x1F});  // movzx r10d, byte [rdi + r11]
+  emit({0x4E, 0x8B, 0x14, 0xD2});        // mov r10, [rdx + r10 * 8]
+  emit({0x45, 0x8A, 0x12});              // mov r10b, [r10]
+
+  // skip:
+  emit({0x48, 0xFF, 0xC0});  // inc rax
+  emit({0x4C, 0x39, 0xC8});  // cmp rax, r9
+  emit({0x0F, 0x82});        // jb loop
+  emit32(static_cast<int32_t>(loop - (code->size() + 4)));
+
+  // done:
+  int32_t to_done = static_cast<int32_t>(code->size() - (skip_loop + 4));
+  memcpy(code->data() + skip_loop, &to_done, sizeof(to_done));
+  emit({0xC3});  // ret
+}
+
+#elif SAFESIDE_GADGET_JIT && SAFESIDE_ARM64
+
+// Emits the loop for the AAPCS64 calling convention:
+//     x0 = data, x1 = size, x2 = oracle, x3 = safe_offset,
+//     x4 = attack_offset, x5 = iterations
+// Uses x6 as the loop counter and x7 to x10 as scratch registers.
+void Emit(size_t alignment, size_t branch_offset, std::vector<uint8_t> *code,
+          size_t *branch_position) {
+  auto emit = [code](uint32_t instruction) {
+    for (int i = 0; i < 4; ++i) {
+      code->push_back(static_cast<uint8_t>(instruction >> (8 * i)));
+    }
+  };
+  // B.cond to an instruction `delta` instructions away.
+  auto branch = [](int32_t delta, uint32_t condition) {
+    return 0x54000000u | ((static_cast<uint32_t>(delta) & 0x7FFFF) << 5) |
+           condition;
+  };
+  const uint32_t kHs = 2, kLo = 3;
+
+  // Instructions between the loop label and the bounds check branch.
+  const size_t kLoopToBranchBytes = 32;
+
+  emit(0xD2800006);  // mov x6, #0
+
+  // The loop below tests at the bottom, so skip it for zero iterations.
+  size_t skip_loop = code->size();
+  emit(0xB4000005);  // cbz x5, done
+
+  // Pad so the branch lands at branch_offset (rounded down to an instruction).
+  branch_offset &= ~static_cast<size_t>(3);
+  size_t padding = (branch_offset + alignment -
+                    (code->size() + kLoopToBranchBytes) % alignment) %
+                   alignment;
+  for (; padding >= 4; padding -= 4) {
+    emit(0xD503201F);  // nop
+  }
+
+  size_t loop = code->size();
+  emit(0xD50B7E21);  // dc civac, x1
+  emit(0xD5033F9F);  // dsb sy
+  emit(0xD5033FDF);  // isb
+  emit(0x910004C7);  // add x7, x6, #1
+  emit(0xEB0500FF);  // cmp x7, x5
+  emit(0x9A830088);  // csel x8, x4, x3, eq
+  emit(0xF9400029);  // ldr x9, [x1]
+  emit(0xEB09011F);  // cmp x8, x9
+
+  *branch_position = code->size();
+  emit(branch(4, kHs));  // b.hs skip
+  emit(0x3868680A);      // ldrb w10, [x0, x8]
+  emit(0xF86A784A);      // ldr x10, [x2, x10, lsl #3]
+  emit(0x3940014A);      // ldrb w10, [x10]
+
+  // skip:
+  emit(0x910004C6);  // add x6, x6, #1
+  emit(0xEB0500DF);  // cmp x6, x5
+  emit(branch((static_cast<int32_t>(loop) -
+               static_cast<int32_t>(code->size())) / 4,
+              kLo));  // b.lo loop
+
+  // done:
+  uint32_t cbz;
+  memcpy(&cbz, code->data() + skip_loop, sizeof(cbz));
+  cbz |= ((static_cast<uint32_t>(code->size() - skip_loop) / 4) & 0x7FFFF)
+         << 5;
+  memcpy(code->data() + skip_loop, &cbz, sizeof(cbz));
+  emit(0xD65F03C0);  // ret
+}
+
+#endif
+
+}  // namespace
+
+JitBoundsCheckGadget::JitBoundsCheckGadget(const Layout &layout) {
+#if SAFESIDE_GADGET_JIT
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t alignment = layout.alignment;
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0 ||
+      alignment > page_size) {
+    return;
+  }
+
+  std::vector<uint8_t> code;
+  size_t branch_position;
+  Emit(alignment, layout.branch_offset % alignment, &code, &branch_position);
+
+  mapping_size_ = (code.size() + page_size - 1) / page_size * page_size;
+  void *hint = reinterpret_cast<void *>(
+      reinterpret_cast<uintptr_t>(layout.address_hint) & ~(page_size - 1));
+  void *mapping = mmap(hint, mapping_size_, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return;
+  }
+  memcpy(mapping, code.data(), code.size());
+  if (mprotect(mapping, mapping_size_, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mapping, mapping_size_);
+    return;
+  }
+  char *begin = static_cast<char *>(mapping);
+  __builtin___clear_cache(begin, begin + code.size());
+
+  mapping_ = mapping;
+  code_ = mapping;
+  code_size_ = code.size();
+  branch_address_ = begin + branch_position;
+  function_ = reinterpret_cast<Function>(mapping);
+#else
+  (void)layout;
+#endif
+}
+
+JitBoundsCheckGadget::~JitBoundsCheckGadget() {
+#if SAFESIDE_GADGET_JIT
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+  }
+#endif
+}
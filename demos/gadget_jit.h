@@ -0,0 +1,99 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_GADGET_JIT_H_
+#define DEMOS_GADGET_JIT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// JitBoundsCheckGadget emits the training-plus-probe loop of spectre_v1_pht_sa
+// as machine code at runtime, so the instructions, their addresses and their
+// alignment are exactly what we ask for, whatever the compiler and its
+// version. The loop is equivalent to:
+//
+//     for (size_t i = 0; i < iterations; ++i) {
+//       FlushDataCacheLine(size);
+//       size_t offset = (i + 1 == iterations) ? attack_offset : safe_offset;
+//       if (offset < *size) {
+//         ForceRead(oracle[data[offset]]);
+//       }
+//     }
+//
+// The offset is chosen with a conditional move, and the only conditional
+// branches are the bounds check, the loop itself and, before the loop, the
+// check for zero iterations. `oracle` is a table of
+// 256 pointers, e.g. to the elements of a TimingArray.
+//
+// Supported on x86-64 and ARM64, under Linux and other systems with mmap.
+// Elsewhere ok() is false and Run() does nothing.
+//
+// Example use:
+//
+//     JitBoundsCheckGadget gadget;
+//     std::array<const void *, 256> oracle;
+//     for (int i = 0; i < 256; ++i) oracle[i] = &timing_array[i];
+//     timing_array.FlushFromCache();
+//     gadget.Run(data, size_in_heap, oracle.data(), safe_offset, offset, 2048);
+class JitBoundsCheckGadget {
+ public:
+  struct Layout {
+    // Alignment of the code, and of the block that holds the bounds check
+    // branch. A power of two, at most the page size.
+    size_t alignment = 64;
+    // Offset of the bounds check branch instruction within its aligned block.
+    // The code is padded with NOPs to put it there, e.g. to test how the
+    // branch position within a fetch block or cache line matters.
+    size_t branch_offset = 0;
+    // Preferred page for the code, which starts at the page boundary. The
+    // branch predictors index by (parts of) the branch address, so placing two
+    // gadgets at the same page offset on pages whose addresses share their low
+    // bits makes their branches alias. Only a hint: check branch_address().
+    const void *address_hint = nullptr;
+  };
+
+  JitBoundsCheckGadget() : JitBoundsCheckGadget(Layout()) {}
+  explicit JitBoundsCheckGadget(const Layout &layout);
+  ~JitBoundsCheckGadget();
+
+  JitBoundsCheckGadget(const JitBoundsCheckGadget &) = delete;
+  JitBoundsCheckGadget &operator=(const JitBoundsCheckGadget &) = delete;
+
+  // Whether code could be generated for this platform.
+  bool ok() const { return function_ != nullptr; }
+
+  // Runs the loop above.
+  void Run(const char *data, size_t *size, const void *const *oracle,
+           size_t safe_offset, size_t attack_offset, size_t iterations) const {
+    if (function_) {
+      function_(data, size, oracle, safe_offset, attack_offset, iterations);
+    }
+  }
+
+  // Address of the bounds check branch instruction.
+  const void *branch_address() const { return branch_address_; }
+
+  // The generated code, e.g. for disassembly.
+  const void *code() const { return code_; }
+  size_t code_size() const { return code_size_; }
+
+ private:
+  using Function = void (*)(const char *data, size_t *size,
+                            const void *const *oracle, size_t safe_offset,
+                            size_t attack_offset, size_t iterations);
+
+  void *mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  const void *code_ = nullptr;
+  size_t code_size_ = 0;
+  const void *branch_address_ = nullptr;
+  Function function_ = nullptr;
+};
+
+#endif  // DEMOS_GADGET_JIT_H_
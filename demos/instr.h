@@ -43,6 +43,12 @@ void MemoryAndSpeculationBarrier();
 // Implementation in instr_*.h.
 void FlushDataCacheLineNoBarrier(const void *address);
 
+// Reads the platform timestamp counter that MeasureReadLatency uses, so the
+// result is in the same units. Not serializing: callers that need ordering
+// should surround it with MemoryAndSpeculationBarrier().
+// Implementation in instr_*.h.
+uint64_t ReadTimestampCounter();
+
 // Convenience wrapper to flush and wait.
 inline void FlushDataCacheLine(void *address) {
   FlushDataCacheLineNoBarrier(address);
@@ -10,6 +10,8 @@
 #ifndef DEMOS_INSTR_AARCH64_H_
 #define DEMOS_INSTR_AARCH64_H_
 
+#include <cstdint>
+
 #include "compiler_specifics.h"
 
 inline SAFESIDE_ALWAYS_INLINE void MemoryAndSpeculationBarrier() {
@@ -32,4 +34,17 @@ inline void FlushDataCacheLineNoBarrier(const void *address) {
       : "memory");
 }
 
+inline SAFESIDE_ALWAYS_INLINE uint64_t ReadTimestampCounter() {
+  // The virtual count, same as MeasureReadLatency. The ISB keeps the read from
+  // being issued early; see measurereadlatency_aarch64.S.
+  uint64_t count;
+  asm volatile(
+      "isb\n"
+      "mrs %0, cntvct_el0\n"
+      : "=r"(count)
+      :
+      : "memory");
+  return count;
+}
+
 #endif  // DEMOS_INSTR_AARCH64_H_
@@ -10,6 +10,8 @@
 #ifndef DEMOS_INSTR_PPC64LE_H_
 #define DEMOS_INSTR_PPC64LE_H_
 
+#include <cstdint>
+
 #include "compiler_specifics.h"
 
 inline SAFESIDE_ALWAYS_INLINE void MemoryAndSpeculationBarrier() {
@@ -32,4 +34,15 @@ inline void FlushDataCacheLineNoBarrier(const void *address) {
       : "memory");
 }
 
+inline SAFESIDE_ALWAYS_INLINE uint64_t ReadTimestampCounter() {
+  // The time base, same as MeasureReadLatency.
+  uint64_t time_base;
+  asm volatile(
+      "mftb %0\n"
+      : "=r"(time_base)
+      :
+      : "memory");
+  return time_base;
+}
+
 #endif  // DEMOS_INSTR_PPC64LE_H_
@@ -10,6 +10,8 @@
 #ifndef DEMOS_INSTR_X86_H_
 #define DEMOS_INSTR_X86_H_
 
+#include <cstdint>
+
 #include "compiler_specifics.h"
 
 #if SAFESIDE_MSVC
@@ -32,4 +34,8 @@ inline void FlushDataCacheLineNoBarrier(const void *address) {
   _mm_clflush(address);
 }
 
+inline SAFESIDE_ALWAYS_INLINE uint64_t ReadTimestampCounter() {
+  return __rdtsc();
+}
+
 #endif  // DEMOS_INSTR_X86_H_
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "latency_profile.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Samples after which outliers are clipped, see Moments::Add.
+const int kWarmup = 16;
+// Variance floor, in squared timer ticks. Hits are often timed at one or two
+// distinct values, and a variance of zero would make any other value
+// infinitely unlikely.
+const double kMinVariance = 1.0;
+// A scan reads up to 256 elements, at most one of which is a hit, so a latency
+// between the two distributions needs that much more evidence to be called a
+// hit. Without it, lines pulled into L2 or L3 by a prefetcher or a neighbour
+// would pass for hits.
+const double kLogPriorOdds = std::log(255.0);
+
+}  // namespace
+
+void LatencyProfile::Moments::Fit(std::vector<uint64_t> *samples) {
+  std::sort(samples->begin(), samples->end());
+  size_t trim = samples->size() / 10;
+  *this = Moments();
+  for (size_t i = trim; i < samples->size() - trim; ++i) {
+    Add((*samples)[i]);
+  }
+}
+
+void LatencyProfile::Moments::Add(uint64_t latency) {
+  double x = static_cast<double>(latency);
+  // A read interrupted by a context switch can take a million ticks. Clip
+  // samples to four standard deviations so one of them doesn't wreck the
+  // variance for the next kWindow samples.
+  if (count >= kWarmup) {
+    double limit = 4 * std::sqrt(std::max(variance, kMinVariance));
+    x = std::min(std::max(x, mean - limit), mean + limit);
+  }
+
+  count = std::min(count + 1, static_cast<int>(kWindow));
+  double weight = 1.0 / count;
+  double delta = x - mean;
+  mean += weight * delta;
+  variance = (1 - weight) * (variance + weight * delta * delta);
+}
+
+bool LatencyProfile::Moments::IsTypical(uint64_t latency) const {
+  double deviation = static_cast<double>(latency) - mean;
+  return deviation * deviation <= 4 * std::max(variance, kMinVariance);
+}
+
+double LatencyProfile::Moments::LogDensity(double x) const {
+  double v = std::max(variance, kMinVariance);
+  return -0.5 * std::log(v) - (x - mean) * (x - mean) / (2 * v);
+}
+
+bool LatencyProfile::IsHit(uint64_t latency) const {
+  if (hit_.count == 0 || miss_.count == 0) {
+    return false;
+  }
+  double x = static_cast<double>(latency);
+  // Far in the tails the wider distribution, usually the misses', always wins,
+  // even on the hit side. Latencies outside the two means are decided by
+  // which side they are on.
+  if (x >= miss_.mean) {
+    return false;
+  }
+  if (x <= hit_.mean) {
+    return true;
+  }
+  return hit_.LogDensity(x) - miss_.LogDensity(x) > kLogPriorOdds;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_LATENCY_PROFILE_H_
+#define DEMOS_LATENCY_PROFILE_H_
+
+#include <cstdint>
+#include <vector>
+
+// Read latency statistics of a single cache line, used to tell a cached read
+// of that line from an uncached one.
+//
+// Lines differ systematically: a line whose page maps to a busy DRAM bank, or
+// whose cache set it shares with other hot lines, is slower to read both from
+// the cache and from memory than its neighbours. One threshold for all lines
+// then has to be loose enough for the slowest hits, so it misreads the fastest
+// misses. LatencyProfile keeps the mean and variance of hits and of misses of
+// its line and classifies a latency by the likelihood ratio of the two normal
+// distributions, weighed against how rare hits are in a scan.
+//
+// The statistics start as plain averages and turn into exponentially weighted
+// ones after kWindow samples, so they can be learned during calibration and
+// then keep tracking drift (e.g. frequency changes) from the measurements of
+// the leak itself. Calibration knows which reads were hits and passes both
+// kinds of samples to Calibrate. The leak only has its own classification,
+// which is sometimes wrong, and feeding a misclassified read back moves the
+// profile towards misclassifying more. So the leak only updates the misses,
+// which are the vast majority of reads, and LearnMiss only takes latencies
+// typical of a miss, i.e. within two standard deviations of the mean.
+class LatencyProfile {
+ public:
+  // Effective number of samples once the averages become exponential.
+  static const int kWindow = 256;
+
+  // Starts over from samples of known hits and misses of the line. The
+  // slowest and fastest tenth of each are dropped, so that the profile
+  // survives a burst of interrupts during calibration.
+  void Calibrate(std::vector<uint64_t> hits, std::vector<uint64_t> misses) {
+    hit_.Fit(&hits);
+    miss_.Fit(&misses);
+  }
+
+  void LearnMiss(uint64_t latency) {
+    if (miss_.IsTypical(latency)) {
+      miss_.Add(latency);
+    }
+  }
+
+  // Whether `latency` is a hit: more likely one than a miss by the prior odds
+  // of a scan, see kLogPriorOdds. False until there is at least one sample of
+  // each.
+  bool IsHit(uint64_t latency) const;
+
+  double hit_mean() const { return hit_.mean; }
+  double miss_mean() const { return miss_.mean; }
+
+ private:
+  struct Moments {
+    double mean = 0;
+    double variance = 0;
+    int count = 0;
+
+    // Replaces the moments with those of the middle 80% of `samples`.
+    void Fit(std::vector<uint64_t> *samples);
+    void Add(uint64_t latency);
+    bool IsTypical(uint64_t latency) const;
+    // Log of the normal density at `x`, up to a constant.
+    double LogDensity(double x) const;
+  };
+
+  Moments hit_;
+  Moments miss_;
+};
+
+#endif  // DEMOS_LATENCY_PROFILE_H_
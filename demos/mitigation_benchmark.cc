@@ -0,0 +1,486 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * Measures what it costs to mitigate the gadgets of the demos, and checks that
+ * the mitigations work. Each gadget is a template over a mitigation policy:
+ *
+ *   bounds check (spectre_v1_pht_*)
+ *     none, speculation barrier after the check (LFENCE on x86), index
+ *     masking with a power-of-two mask, and SLH-style masking with a mask
+ *     derived from the bounds check itself (like Linux's array_index_nospec)
+ *   indirect call (spectre_v1_btb_*)
+ *     none, and a retpoline (x86-64 only)
+ *   return (ret2spec_*)
+ *     none, and stuffing the return stack buffer with harmless entries before
+ *     the returns (x86-64 only)
+ *
+ * For each combination the benchmark reports the cost of one architectural
+ * call of the gadget in timestamp counter ticks, the overhead over the
+ * unmitigated gadget, and in how many of 200 rounds the gadget still leaked
+ * its secret. The unmitigated rows show whether the gadget leaks on this
+ * machine at all; a mitigation only proves something where they do.
+ **/
+
+#include "compiler_specifics.h"
+
+#if !SAFESIDE_GNUC
+#  error Unsupported compiler. GCC or Clang required.
+#endif
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cpu_isolation.h"
+#include "instr.h"
+#include "timing_array.h"
+#include "utils.h"
+
+namespace {
+
+// The secret every gadget tries to leak, right after 16 bytes of public data.
+constexpr size_t kPublicSize = 16;
+struct GadgetData {
+  char public_data[kPublicSize];
+  char secret;
+};
+GadgetData gadget_data;
+// Index masking clamps with this mask, which is known at compile time, so the
+// masked index doesn't wait for the size to load.
+constexpr size_t kPublicSizeMask = kPublicSize - 1;
+static_assert((kPublicSize & kPublicSizeMask) == 0,
+              "Index masking needs a power-of-two public size");
+constexpr char kPublicByte = 'x';
+constexpr char kSecretByte = 'S';
+
+// Also a global rather than a parameter in the recursive gadgets, where it
+// would otherwise live in stack frames we flush.
+TimingArray *timing_array;
+
+constexpr int kLeakRounds = 200;
+constexpr int kCostIterations = 100000;
+
+// Keeps the compiler from knowing anything about `value`, e.g. that a mask
+// computed from a condition it already checked is all ones.
+template <typename T>
+inline SAFESIDE_ALWAYS_INLINE T HideFromOptimizer(T value) {
+  asm volatile("" : "+r"(value));
+  return value;
+}
+
+// --- Bounds check mitigations ---------------------------------------------
+//
+// Index() is called inside `if (index < size)` and returns the index to read.
+
+struct NoBoundsMitigation {
+  static const char *Name() { return "none"; }
+  static SAFESIDE_ALWAYS_INLINE size_t Index(size_t index, size_t) {
+    return index;
+  }
+};
+
+// Stops speculation past the check; see fence_benchmark for alternatives.
+struct BarrierBoundsMitigation {
+  static const char *Name() {
+#if SAFESIDE_X64 || SAFESIDE_IA32
+    return "lfence";
+#else
+    return "barrier";
+#endif
+  }
+  static SAFESIDE_ALWAYS_INLINE size_t Index(size_t index, size_t) {
+#if SAFESIDE_X64 || SAFESIDE_IA32
+    _mm_lfence();
+#elif SAFESIDE_ARM64
+    asm volatile("dsb sy\nisb\n" : : : "memory");
+#elif SAFESIDE_PPC
+    // The speculation barrier that POWER firmware advertises.
+    asm volatile("ori 31,31,0\n" : : : "memory");
+#endif
+    return index;
+  }
+};
+
+// Clamps the index into the array with a constant mask, which needs a
+// power-of-two array size. Speculation still happens, but stays in bounds.
+// Unlike SLH, the masked read doesn't depend on the (slow) size.
+struct MaskingBoundsMitigation {
+  static const char *Name() { return "index masking"; }
+  static SAFESIDE_ALWAYS_INLINE size_t Index(size_t index, size_t) {
+    return index & kPublicSizeMask;
+  }
+};
+
+// Computes, without a branch, a mask that is all ones if index < size and
+// zero otherwise. When the bounds check is mispredicted the mask is zero, so
+// the speculative read goes to index 0. Works for any size.
+struct SlhBoundsMitigation {
+  static const char *Name() { return "slh masking"; }
+  static SAFESIDE_ALWAYS_INLINE size_t Index(size_t index, size_t size) {
+    // The top bit of (index | (size - 1 - index)) is clear iff index < size.
+    // Shifting the complement arithmetically smears it into a mask.
+    intptr_t top = static_cast<intptr_t>(
+        HideFromOptimizer(index) | (size - 1 - index));
+    size_t mask = static_cast<size_t>(~top >> (sizeof(intptr_t) * 8 - 1));
+    return index & mask;
+  }
+};
+
+// spectre_v1_pht_sa's gadget: trains the bounds check with in-bounds offsets
+// and reads out of bounds on the last iteration.
+template <typename Mitigation>
+int LeakWithBoundsCheck() {
+  std::unique_ptr<size_t> size_in_heap(new size_t(kPublicSize));
+  const char *data = gadget_data.public_data;
+  const size_t secret_offset = kPublicSize;
+
+  int leaks = 0;
+  for (int round = 0; round < kLeakRounds; ++round) {
+    timing_array->FlushFromCache();
+    size_t safe_offset = round % kPublicSize;
+    for (size_t i = 0; i < 2048; ++i) {
+      FlushDataCacheLine(size_in_heap.get());
+      size_t local_offset =
+          secret_offset +
+          (safe_offset - secret_offset) * static_cast<bool>((i + 1) % 2048);
+      if (local_offset < *size_in_heap) {
+        size_t index = Mitigation::Index(local_offset, *size_in_heap);
+        ForceRead(&(*timing_array)[data[index]]);
+      }
+    }
+    if (timing_array->FindFirstCachedElementIndexAfter(kPublicByte) ==
+        kSecretByte) {
+      ++leaks;
+    }
+  }
+  return leaks;
+}
+
+template <typename Mitigation>
+double BoundsCheckCost() {
+  const char *data = gadget_data.public_data;
+  size_t size = HideFromOptimizer(kPublicSize);
+  unsigned int sum = 0;
+  uint64_t start = ReadTimestampCounter();
+  for (int i = 0; i < kCostIterations; ++i) {
+    size_t offset = HideFromOptimizer(static_cast<size_t>(i) % kPublicSize);
+    if (offset < size) {
+      sum += data[Mitigation::Index(offset, size)];
+    }
+  }
+  uint64_t ticks = ReadTimestampCounter() - start;
+  HideFromOptimizer(sum);
+  return static_cast<double>(ticks) / kCostIterations;
+}
+
+// --- Indirect call mitigations --------------------------------------------
+
+// Reads the byte at `index`, from the secret if `read_secret` is set.
+using ReadFunction = char (*)(size_t index, bool read_secret);
+
+SAFESIDE_NEVER_INLINE char RealRead(size_t index, bool read_secret) {
+  // Branchless, like DataAccessor::GetDataPtr in spectre_v1_btb_sa.
+  return gadget_data.public_data[index + kPublicSize * read_secret];
+}
+
+SAFESIDE_NEVER_INLINE char CensoringRead(size_t index, bool) {
+  return gadget_data.public_data[index];
+}
+
+struct NoCallMitigation {
+  static const char *Name() { return "none"; }
+  static constexpr bool kSupported = true;
+  static SAFESIDE_ALWAYS_INLINE char Call(ReadFunction function, size_t index,
+                                          bool read_secret) {
+    return function(index, read_secret);
+  }
+};
+
+#if SAFESIDE_X64
+// Calls through a return instead of an indirect branch. The return is
+// predicted to go to a pause/lfence loop, so nothing useful runs
+// speculatively, and the indirect branch predictor is never consulted.
+// This is __x86_indirect_thunk_r11 from the kernel, inlined.
+struct RetpolineCallMitigation {
+  static const char *Name() { return "retpoline"; }
+  static constexpr bool kSupported = true;
+  static SAFESIDE_ALWAYS_INLINE char Call(ReadFunction function, size_t index,
+                                          bool read_secret) {
+    register ReadFunction target asm("r11") = function;
+    uint64_t rdi = index, rsi = read_secret, rax;
+    asm volatile(
+        // The calls below write under the stack pointer, where the compiler
+        // may keep data (the red zone), and the callee expects an aligned
+        // stack. Step over the red zone and align.
+        "mov %%rsp, %%rbx\n"
+        "sub $128, %%rsp\n"
+        "and $-16, %%rsp\n"
+        "call 4f\n"
+        "jmp 5f\n"
+        // The thunk.
+        "4: call 2f\n"
+        "1: pause\n"
+        "lfence\n"
+        "jmp 1b\n"
+        "2: mov %%r11, (%%rsp)\n"
+        "ret\n"
+        "5: mov %%rbx, %%rsp\n"
+        : "=a"(rax), "+D"(rdi), "+S"(rsi), "+r"(target)
+        :
+        : "rbx", "rcx", "rdx", "r8", "r9", "r10", "memory", "cc", "xmm0",
+          "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8",
+          "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15");
+    return static_cast<char>(rax);
+  }
+};
+#endif
+
+// spectre_v1_btb_sa's gadget with function pointers instead of virtual
+// methods: trains the call site with RealRead and calls CensoringRead, asking
+// it for the secret, on the last iteration.
+constexpr size_t kCallsPerRound = 1024;
+
+template <typename Mitigation>
+int LeakWithIndirectCall() {
+  std::unique_ptr<std::array<ReadFunction, kCallsPerRound>> functions(
+      new std::array<ReadFunction, kCallsPerRound>);
+  std::unique_ptr<ReadFunction> censoring(new ReadFunction(CensoringRead));
+
+  int leaks = 0;
+  for (int round = 0; round < kLeakRounds; ++round) {
+    timing_array->FlushFromCache();
+    functions->fill(RealRead);
+    size_t last = kCallsPerRound - 1;
+    (*functions)[last] = *censoring;
+
+    for (size_t i = 0; i <= last; ++i) {
+      // Flush the pointer so that the call has to be predicted for a while.
+      FlushDataCacheLine(&(*functions)[i]);
+      bool read_secret = (i == last);
+      ForceRead(&(*timing_array)[Mitigation::Call((*functions)[i], 0,
+                                                  read_secret)]);
+    }
+    if (timing_array->FindFirstCachedElementIndexAfter(kPublicByte) ==
+        kSecretByte) {
+      ++leaks;
+    }
+  }
+  return leaks;
+}
+
+template <typename Mitigation>
+double IndirectCallCost() {
+  ReadFunction function = HideFromOptimizer(&CensoringRead);
+  unsigned int sum = 0;
+  uint64_t start = ReadTimestampCounter();
+  for (int i = 0; i < kCostIterations; ++i) {
+    sum += Mitigation::Call(function, i % kPublicSize, false);
+  }
+  uint64_t ticks = ReadTimestampCounter() - start;
+  HideFromOptimizer(sum);
+  return static_cast<double>(ticks) / kCostIterations;
+}
+
+// --- Return mitigations ---------------------------------------------------
+//
+// BeforeReturns() runs right before a chain of returns whose return stack
+// buffer entries were overwritten.
+
+struct NoReturnMitigation {
+  static const char *Name() { return "none"; }
+  static SAFESIDE_ALWAYS_INLINE void BeforeReturns() {}
+};
+
+#if SAFESIDE_X64
+// Fills the return stack buffer with 32 entries that point at pause/lfence
+// loops, like the kernel's FILL_RETURN_BUFFER, and drops the corresponding
+// return addresses from the stack again.
+struct RsbStuffingMitigation {
+  static const char *Name() { return "rsb stuffing"; }
+  static SAFESIDE_ALWAYS_INLINE void BeforeReturns() {
+    uint64_t loops = 16;
+    asm volatile(
+        // Don't clobber the red zone.
+        "sub $128, %%rsp\n"
+        "1: call 2f\n"
+        "3: pause\n"
+        "lfence\n"
+        "jmp 3b\n"
+        "2: call 4f\n"
+        "5: pause\n"
+        "lfence\n"
+        "jmp 5b\n"
+        "4: dec %0\n"
+        "jnz 1b\n"
+        "add $(32 * 8 + 128), %%rsp\n"
+        : "+r"(loops)
+        :
+        : "memory", "cc");
+  }
+};
+#endif
+
+// ret2spec_sa's gadget. ReturnsTrue recurses, and at the bottom calls
+// ReturnsFalse, which recurses as deep and overwrites the return stack buffer
+// with its own return sites. ReturnsTrue's returns are then predicted to go to
+// ReturnsFalse's return site, where the impossible branch reads the secret.
+constexpr int kRecursionDepth = 64;
+bool false_value = false;
+bool flush_return_addresses = true;
+std::vector<char *> stack_mark_pointers;
+
+SAFESIDE_NEVER_INLINE bool ReturnsFalse(int counter) {
+  if (counter > 0) {
+    if (ReturnsFalse(counter - 1)) {
+      // Unreachable.
+      ForceRead(&(*timing_array)[gadget_data.secret]);
+      std::cout << "Dead code. Must not be printed." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  return false_value;
+}
+
+template <typename Mitigation>
+SAFESIDE_NEVER_INLINE bool ReturnsTrue(int counter) {
+  char stack_mark = 'a';
+  stack_mark_pointers.push_back(&stack_mark);
+
+  if (counter > 0) {
+    ReturnsTrue<Mitigation>(counter - 1);
+  } else {
+    ReturnsFalse(kRecursionDepth);
+    Mitigation::BeforeReturns();
+  }
+
+  // Flush the return address, so the return has to be predicted for a while.
+  stack_mark_pointers.pop_back();
+  if (flush_return_addresses) {
+    FlushFromDataCache(&stack_mark, stack_mark_pointers.back());
+  }
+  return true;
+}
+
+template <typename Mitigation>
+void RunReturnGadget() {
+  char stack_mark = 'a';
+  stack_mark_pointers.push_back(&stack_mark);
+  ReturnsTrue<Mitigation>(kRecursionDepth);
+  stack_mark_pointers.pop_back();
+}
+
+template <typename Mitigation>
+int LeakWithReturns() {
+  flush_return_addresses = true;
+  int leaks = 0;
+  for (int round = 0; round < kLeakRounds; ++round) {
+    timing_array->FlushFromCache();
+    RunReturnGadget<Mitigation>();
+    if (timing_array->FindFirstCachedElementIndex() == kSecretByte) {
+      ++leaks;
+    }
+  }
+  return leaks;
+}
+
+// Per call of ReturnsTrue, i.e. per mitigated return chain.
+template <typename Mitigation>
+double ReturnsCost() {
+  flush_return_addresses = false;
+  const int calls = kCostIterations / kRecursionDepth;
+  uint64_t start = ReadTimestampCounter();
+  for (int i = 0; i < calls; ++i) {
+    RunReturnGadget<Mitigation>();
+  }
+  uint64_t ticks = ReadTimestampCounter() - start;
+  return static_cast<double>(ticks) / calls;
+}
+
+// --- Reporting ------------------------------------------------------------
+
+void PrintRow(const char *gadget, const char *mitigation, double cost,
+              double baseline_cost, int leaks) {
+  std::cout << std::left << std::setw(16) << gadget << std::setw(16)
+            << mitigation << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << cost << std::setw(12) << cost - baseline_cost
+            << std::setw(10)
+            << std::to_string(leaks) + "/" + std::to_string(kLeakRounds)
+            << std::endl;
+}
+
+template <typename Mitigation>
+void MeasureBoundsCheck(double *baseline) {
+  double cost = BoundsCheckCost<Mitigation>();
+  if (*baseline < 0) {
+    *baseline = cost;
+  }
+  PrintRow("bounds check", Mitigation::Name(), cost, *baseline,
+           LeakWithBoundsCheck<Mitigation>());
+}
+
+template <typename Mitigation>
+void MeasureIndirectCall(double *baseline) {
+  double cost = IndirectCallCost<Mitigation>();
+  if (*baseline < 0) {
+    *baseline = cost;
+  }
+  PrintRow("indirect call", Mitigation::Name(), cost, *baseline,
+           LeakWithIndirectCall<Mitigation>());
+}
+
+template <typename Mitigation>
+void MeasureReturns(double *baseline) {
+  double cost = ReturnsCost<Mitigation>();
+  if (*baseline < 0) {
+    *baseline = cost;
+  }
+  PrintRow("return", Mitigation::Name(), cost, *baseline,
+           LeakWithReturns<Mitigation>());
+}
+
+}  // namespace
+
+int main() {
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+
+  memset(gadget_data.public_data, kPublicByte, kPublicSize);
+  gadget_data.secret = kSecretByte;
+  std::unique_ptr<TimingArray> oracle(new TimingArray);
+  timing_array = oracle.get();
+
+  std::cout << std::left << std::setw(16) << "gadget" << std::setw(16)
+            << "mitigation" << std::right << std::setw(12) << "ticks/call"
+            << std::setw(12) << "overhead" << std::setw(10) << "leaks"
+            << std::endl;
+
+  double baseline = -1;
+  MeasureBoundsCheck<NoBoundsMitigation>(&baseline);
+  MeasureBoundsCheck<BarrierBoundsMitigation>(&baseline);
+  MeasureBoundsCheck<MaskingBoundsMitigation>(&baseline);
+  MeasureBoundsCheck<SlhBoundsMitigation>(&baseline);
+
+  baseline = -1;
+  MeasureIndirectCall<NoCallMitigation>(&baseline);
+#if SAFESIDE_X64
+  MeasureIndirectCall<RetpolineCallMitigation>(&baseline);
+#endif
+
+  baseline = -1;
+  MeasureReturns<NoReturnMitigation>(&baseline);
+#if SAFESIDE_X64
+  MeasureReturns<RsbStuffingMitigation>(&baseline);
+#endif
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "multi_timing_array.h"
+
+#include <array>
+
+#include "asm/measurereadlatency.h"
+#include "core_types.h"
+#include "instr.h"
+#include "timing_array.h"
+
+MultiTimingArray::MultiTimingArray(size_t oracles)
+    : oracles_(oracles),
+      permutation_(TimingArray::DefaultPermutation()) {
+  arena_ = OracleArena::Acquire(oracles, &colors_);
+  calibrations_.resize(CoreTypeCount());
+  SwitchToCurrentCoreType();
+}
+
+MultiTimingArray::~MultiTimingArray() { arena_->ReleaseColors(colors_); }
+
+bool MultiTimingArray::SwitchToCurrentCoreType() {
+  if (calibrations_.size() > 1) {
+    core_type_ = CurrentCoreType();
+  }
+  Calibration &calibration = calibrations_[core_type_];
+  if (!calibration.line_profiles.empty()) {
+    return false;
+  }
+
+  // TimingArray calibrates its threshold once per process and core type;
+  // reuse it.
+  calibration.threshold = TimingArray().cached_read_latency_threshold();
+
+  // The arena calibrates the profiles of every color once per core type.
+  // Scans read an oracle in index order, so that's the order to calibrate in.
+  std::vector<size_t> pages;
+  for (size_t i = 0; i < kElementsPerOracle; ++i) {
+    pages.push_back(permutation_(i));
+  }
+  calibration.line_profiles.resize(oracles_);
+  for (size_t k = 0; k < oracles_; ++k) {
+    std::vector<LatencyProfile> by_page =
+        arena_->LineProfiles(colors_[k], core_type_, pages);
+    for (size_t i = 0; i < kElementsPerOracle; ++i) {
+      calibration.line_profiles[k].push_back(by_page[permutation_(i)]);
+    }
+  }
+  return true;
+}
+
+void MultiTimingArray::FlushFromCache() {
+  for (size_t k = 0; k < oracles_; ++k) {
+    for (size_t i = 0; i < kElementsPerOracle; ++i) {
+      FlushDataCacheLineNoBarrier(&at(k, i));
+    }
+  }
+
+  // Wait for flushes to finish.
+  MemoryAndSpeculationBarrier();
+}
+
+int MultiTimingArray::FindFirstCachedElementIndexAfter(size_t oracle,
+                                                       int start_after) {
+  if (oracle >= oracles_ || start_after < 0 ||
+      static_cast<size_t>(start_after) >= kElementsPerOracle) {
+    return -1;
+  }
+
+  // Calibrating brings the elements into the cache, so there is nothing to
+  // find this time.
+  if (SwitchToCurrentCoreType()) {
+    return -1;
+  }
+  const uint64_t threshold = calibrations_[core_type_].threshold;
+  std::vector<LatencyProfile> &profiles =
+      calibrations_[core_type_].line_profiles[oracle];
+
+  // Everything read before the hit was a miss, see TimingArray.
+  std::array<uint64_t, kElementsPerOracle> latencies;
+  int found = -1;
+  size_t scanned = 0;
+  while (scanned < kElementsPerOracle) {
+    size_t el = (start_after + 1 + scanned) % kElementsPerOracle;
+    latencies[scanned] = MeasureReadLatency(&at(oracle, el));
+    ++scanned;
+    if (latencies[scanned - 1] <= threshold ||
+        profiles[el].IsHit(latencies[scanned - 1])) {
+      found = static_cast<int>(el);
+      break;
+    }
+  }
+
+  for (size_t j = 0; j < scanned; ++j) {
+    size_t el = (start_after + 1 + j) % kElementsPerOracle;
+    if (static_cast<int>(el) != found) {
+      profiles[el].LearnMiss(latencies[j]);
+    }
+  }
+  return found;
+}
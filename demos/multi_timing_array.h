@@ -0,0 +1,114 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_MULTI_TIMING_ARRAY_H_
+#define DEMOS_MULTI_TIMING_ARRAY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "latency_profile.h"
+#include "oracle_arena.h"
+#include "oracle_permutation.h"
+
+// MultiTimingArray is a set of independent oracles, each like a TimingArray,
+// for leaking several bytes in one speculative window: the gadget encodes
+// byte k into oracle k, and each oracle is decoded on its own.
+//
+// The oracles share the pages of an OracleArena, with each other and with
+// TimingArrays. As in TimingArray, every element is on its own page, elements
+// within an oracle are permuted, and consecutive elements fall into different
+// cache sets. Each oracle is a different color of the arena: its elements sit
+// at a different line offset within their pages than the elements of the
+// other oracles, so the lines a single window loads (one per oracle) are
+// spread over different cache sets instead of competing for the same ones.
+//
+// Scans classify every element with its own LatencyProfile, per core type, as
+// TimingArray does, and learn from the misses they see. Unlike TimingArray's,
+// they also take any read at or below TimingArray's threshold as a hit: the
+// later loads of a wide window often haven't reached L1 by the time the window
+// closes, and are slower than the L1 hits the profiles are calibrated on.
+//
+// Example use:
+//
+//     MultiTimingArray mta(4);
+//     mta.FlushFromCache();
+//     for (size_t k = 0; k < mta.oracles(); ++k) {
+//       ForceRead(&mta.at(k, secret[k]));  // done speculatively by a gadget
+//     }
+//     for (size_t k = 0; k < mta.oracles(); ++k) {
+//       int byte = mta.FindFirstCachedElementIndex(k);
+//     }
+class MultiTimingArray {
+ public:
+  using ValueType = int;
+  static const size_t kElementsPerOracle = 256;
+
+  // At most OracleArena::kColors oracles.
+  explicit MultiTimingArray(size_t oracles);
+  ~MultiTimingArray();
+
+  MultiTimingArray(MultiTimingArray&) = delete;
+  MultiTimingArray& operator=(MultiTimingArray&) = delete;
+
+  size_t oracles() const { return oracles_; }
+
+  // Element `i` of oracle `oracle`.
+  ValueType& at(size_t oracle, size_t i) {
+    // The default permutation of TimingArray, see there.
+    static_assert(kElementsPerOracle == 256, "OraclePermutation is mod 256");
+    size_t el = permutation_(i);
+    return *reinterpret_cast<ValueType*>(arena_->Line(el, colors_[oracle]));
+  }
+
+  // Flushes all elements of all oracles from the cache.
+  void FlushFromCache();
+
+  // Like TimingArray::FindFirstCachedElementIndexAfter, on oracle `oracle`.
+  // Likewise, a scan on a core type not calibrated for yet calibrates and
+  // reports no cached element (-1).
+  int FindFirstCachedElementIndexAfter(size_t oracle, int start_after);
+  int FindFirstCachedElementIndex(size_t oracle) {
+    return FindFirstCachedElementIndexAfter(oracle, kElementsPerOracle - 1);
+  }
+
+  // The threshold of TimingArray and the latency profile of element `i` of
+  // oracle `oracle` that scans use, on the core type of the last calibration
+  // or scan.
+  uint64_t cached_read_latency_threshold() const {
+    return calibrations_[core_type_].threshold;
+  }
+  const LatencyProfile& line_profile(size_t oracle, size_t i) const {
+    return calibrations_[core_type_].line_profiles[oracle][i];
+  }
+
+ private:
+  // Makes the profiles of the current core type current, calibrating them if
+  // needed. Returns true if it calibrated, which disturbs the cache.
+  bool SwitchToCurrentCoreType();
+
+  size_t oracles_;
+  OraclePermutation permutation_;
+  // The arena color of every oracle.
+  std::shared_ptr<OracleArena> arena_;
+  std::vector<int> colors_;
+  // What was calibrated on one core type.
+  struct Calibration {
+    uint64_t threshold = 0;
+    // By oracle and element index. Empty until calibrated.
+    std::vector<std::vector<LatencyProfile>> line_profiles;
+  };
+  // Indexed by core type.
+  std::vector<Calibration> calibrations_;
+  int core_type_ = 0;
+};
+
+#endif  // DEMOS_MULTI_TIMING_ARRAY_H_
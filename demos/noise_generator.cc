@@ -0,0 +1,229 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "noise_generator.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX || SAFESIDE_MAC
+#  include <unistd.h>
+#endif
+
+#if SAFESIDE_LINUX
+#  include <sched.h>
+#endif
+
+#if SAFESIDE_MSVC
+#  include <intrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "cpu_isolation.h"
+#include "hardware_constants.h"
+#include "utils.h"
+
+namespace {
+
+// Returns the size of CPU 0's last-level cache in bytes, or 32MB if unknown.
+size_t LastLevelCacheBytes() {
+  size_t bytes = 32 << 20;
+  for (int index = 0; index < 8; ++index) {
+    std::ifstream in("/sys/devices/system/cpu/cpu0/cache/index" +
+                     std::to_string(index) + "/size");
+    size_t size;
+    std::string unit;
+    if (!(in >> size)) {
+      break;
+    }
+    // The format is e.g. "32768K" or "105M". The last level is listed last.
+    in >> unit;
+    bytes = size * (unit == "M" ? (1 << 20) : unit == "K" ? (1 << 10) : 1);
+  }
+  return bytes;
+}
+
+// Marks one arm of an if. Code the compiler can't see into keeps it from
+// turning the if into a conditional move, so the branch stays a branch.
+#if SAFESIDE_GNUC
+#  define NOISE_BRANCH_ARM(name) asm volatile("# " name ::: "memory")
+#else
+#  define NOISE_BRANCH_ARM(name) _ReadWriteBarrier()
+#endif
+
+// Small, fast pseudo-random generator. Good enough to defeat prefetchers and
+// branch predictors.
+inline uint64_t XorShift(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+}  // namespace
+
+std::vector<NoiseProfile> AllNoiseProfiles() {
+  return {NoiseProfile::kMemoryBandwidth, NoiseProfile::kLlcThrash,
+          NoiseProfile::kSiblingAlu, NoiseProfile::kSiblingBranch,
+          NoiseProfile::kSyscallStorm};
+}
+
+const char *NoiseProfileName(NoiseProfile profile) {
+  switch (profile) {
+    case NoiseProfile::kMemoryBandwidth:
+      return "memory-bandwidth";
+    case NoiseProfile::kLlcThrash:
+      return "llc-thrash";
+    case NoiseProfile::kSiblingAlu:
+      return "sibling-alu";
+    case NoiseProfile::kSiblingBranch:
+      return "sibling-branch";
+    case NoiseProfile::kSyscallStorm:
+      return "syscall-storm";
+  }
+  return "unknown";
+}
+
+bool ParseNoiseProfile(const std::string &name, NoiseProfile *profile) {
+  for (NoiseProfile p : AllNoiseProfiles()) {
+    if (name == NoiseProfileName(p)) {
+      *profile = p;
+      return true;
+    }
+  }
+  return false;
+}
+
+NoiseGenerator::NoiseGenerator(NoiseProfile profile, int threads) {
+  if (profile == NoiseProfile::kMemoryBandwidth ||
+      profile == NoiseProfile::kLlcThrash) {
+    // Write to every page so the buffer is backed by real memory rather than
+    // the shared zero page.
+    buffer_.resize(2 * LastLevelCacheBytes(), 1);
+  }
+
+  // Choose where the threads go.
+  int measuring_cpu = CurrentCpu();
+  std::vector<int> measuring_core = SiblingCpus(measuring_cpu);
+  std::vector<int> cpus;
+  if (profile == NoiseProfile::kSiblingAlu ||
+      profile == NoiseProfile::kSiblingBranch) {
+    cpus = measuring_core;
+  } else {
+    // Not AllowedCpus(): callers have usually pinned themselves with
+    // CpuIsolation already, which the threads would inherit.
+    measuring_core.push_back(measuring_cpu);
+    for (int cpu : OnlineCpus()) {
+      if (std::find(measuring_core.begin(), measuring_core.end(), cpu) ==
+          measuring_core.end()) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+
+  for (int i = 0; i < threads; ++i) {
+    int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+    threads_.emplace_back(
+        new std::thread(&NoiseGenerator::Run, this, profile, cpu, i, threads));
+  }
+
+  // Don't return until the noise is actually running.
+  while (started_threads_ < threads) {
+    std::this_thread::yield();
+  }
+}
+
+NoiseGenerator::~NoiseGenerator() {
+  stop_ = true;
+  for (auto &thread : threads_) {
+    thread->join();
+  }
+}
+
+void NoiseGenerator::Run(NoiseProfile profile, int cpu, int index,
+                         int threads) {
+#if SAFESIDE_LINUX
+  // Threads inherit the creator's policy. In RealtimeMode that would make the
+  // noise a busy-looping real-time thread, on the measuring CPU if unpinned.
+  sched_param param = {};
+  sched_setscheduler(0, SCHED_OTHER, &param);
+#endif
+  if (cpu != -1 && PinCurrentThreadToCpu(cpu)) {
+    ++pinned_threads_;
+  }
+  ++started_threads_;
+
+  // Each memory bandwidth thread writes its own slice of the buffer.
+  size_t slice_bytes = buffer_.size() / threads;
+  char *slice = buffer_.data() + index * slice_bytes;
+
+  uint64_t state = 0x9E3779B97F4A7C15ull + index;
+  volatile uint64_t sink = 0;
+
+  while (!stop_.load(std::memory_order_relaxed)) {
+    switch (profile) {
+      case NoiseProfile::kMemoryBandwidth:
+        // Sequential writes and reads at full line granularity, which the
+        // hardware prefetchers turn into maximum DRAM traffic.
+        memset(slice, static_cast<int>(state++), slice_bytes);
+        for (size_t i = 0; i < slice_bytes; i += kCacheLineBytes) {
+          sink = sink + slice[i];
+        }
+        break;
+
+      case NoiseProfile::kLlcThrash:
+        // Random lines across the whole buffer, defeating prefetchers so each
+        // access is a demand miss that evicts something.
+        for (int i = 0; i < 100000; ++i) {
+          size_t line = XorShift(&state) % (buffer_.size() / kCacheLineBytes);
+          ForceRead(&buffer_[line * kCacheLineBytes]);
+        }
+        break;
+
+      case NoiseProfile::kSiblingAlu: {
+        uint64_t x = state | 1;
+        for (int i = 0; i < 100000; ++i) {
+          x = x * 6364136223846793005ull + 1442695040888963407ull;
+        }
+        sink = x;
+        break;
+      }
+
+      case NoiseProfile::kSiblingBranch: {
+        uint64_t taken = 0;
+        for (int i = 0; i < 100000; ++i) {
+          // Each branch depends on a fresh random bit.
+          if (XorShift(&state) & 1) {
+            NOISE_BRANCH_ARM("taken");
+            ++taken;
+          } else {
+            NOISE_BRANCH_ARM("not taken");
+            taken += 3;
+          }
+        }
+        sink = taken;
+        break;
+      }
+
+      case NoiseProfile::kSyscallStorm:
+        for (int i = 0; i < 1000; ++i) {
+#if SAFESIDE_LINUX || SAFESIDE_MAC
+          sink = sink + getppid();
+#else
+          std::this_thread::yield();
+#endif
+        }
+        break;
+    }
+  }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_NOISE_GENERATOR_H_
+#define DEMOS_NOISE_GENERATOR_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Kinds of background load that disturb cache timing side-channels in
+// different ways.
+enum class NoiseProfile {
+  // Streams through a large buffer, saturating memory bandwidth. Slows down
+  // and adds variance to every cache miss.
+  kMemoryBandwidth,
+  // Touches a buffer bigger than the last-level cache in an unpredictable
+  // order, evicting oracle lines and causing false negatives.
+  kLlcThrash,
+  // Runs a dependent integer multiply chain on the measuring core's SMT
+  // siblings, competing for execution ports.
+  kSiblingAlu,
+  // Runs unpredictable data-dependent branches on the measuring core's SMT
+  // siblings, competing for branch predictor state.
+  kSiblingBranch,
+  // Issues cheap system calls as fast as possible, causing frequent kernel
+  // entries, TLB and cache pollution on the cores it runs on.
+  kSyscallStorm,
+};
+
+// Returns all profiles, in declaration order.
+std::vector<NoiseProfile> AllNoiseProfiles();
+
+// Returns the command-line name of `profile`, e.g. "llc-thrash".
+const char* NoiseProfileName(NoiseProfile profile);
+
+// Parses a command-line name. Returns false if `name` isn't a profile.
+bool ParseNoiseProfile(const std::string& name, NoiseProfile* profile);
+
+// NoiseGenerator runs background load of one profile in helper threads for as
+// long as it lives. Intensity is the number of threads.
+//
+// Threads are placed relative to the CPU the constructing thread runs on (the
+// "measuring" CPU): sibling profiles go on its SMT siblings, all other
+// profiles go on other physical cores. When no such CPUs are available the
+// threads are left unpinned, in which case they share CPUs with the
+// measurement according to the OS scheduler.
+//
+// Example use:
+//
+//     CpuIsolation isolation;
+//     NoiseGenerator noise(NoiseProfile::kLlcThrash, 2);
+//     // ... measure leak throughput ...
+class NoiseGenerator {
+ public:
+  NoiseGenerator(NoiseProfile profile, int threads);
+  ~NoiseGenerator();
+
+  NoiseGenerator(const NoiseGenerator&) = delete;
+  NoiseGenerator& operator=(const NoiseGenerator&) = delete;
+
+  // Number of helper threads that could be pinned where the profile wants.
+  int pinned_threads() const { return pinned_threads_; }
+
+ private:
+  void Run(NoiseProfile profile, int cpu, int index, int threads);
+
+  std::atomic<bool> stop_{false};
+  std::atomic<int> started_threads_{0};
+  std::atomic<int> pinned_threads_{0};
+
+  // Used by the memory profiles. Sized to a multiple of the last-level
+  // cache so that touching all of it evicts everything else. Memory bandwidth
+  // threads each write their own slice.
+  std::vector<char> buffer_;
+
+  std::vector<std::unique_ptr<std::thread>> threads_;
+};
+
+#endif  // DEMOS_NOISE_GENERATOR_H_
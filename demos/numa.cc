@@ -0,0 +1,165 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "numa.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX || SAFESIDE_MAC
+#  define SAFESIDE_NUMA_MMAP 1
+#  include <sys/mman.h>
+#endif
+
+#if SAFESIDE_LINUX
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#  if defined(SYS_mbind) && defined(SYS_move_pages)
+#    define SAFESIDE_NUMA 1
+#  endif
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <new>
+#include <string>
+
+#include "cpu_isolation.h"
+
+namespace {
+
+// From <linux/mempolicy.h>, which isn't always installed.
+const int kMpolBind = 2;
+const unsigned kMpolMfMove = 1 << 1;
+// Nodes the mbind node mask can express.
+const int kMaxNodes = 1024;
+
+std::atomic<int> oracle_node(-1);
+
+// CPU to node, from the cpulist of every node.
+const std::map<int, int> &NodesOfCpus() {
+  static const std::map<int, int> *nodes = [] {
+    std::map<int, int> *nodes = new std::map<int, int>;
+    for (int node : NumaNodes()) {
+      for (int cpu : ParseCpuList(ReadFirstLine(
+               "/sys/devices/system/node/node" + std::to_string(node) +
+               "/cpulist"))) {
+        (*nodes)[cpu] = node;
+      }
+    }
+    return nodes;
+  }();
+  return *nodes;
+}
+
+}  // namespace
+
+std::vector<int> NumaNodes() {
+  std::vector<int> nodes =
+      ParseCpuList(ReadFirstLine("/sys/devices/system/node/has_memory"));
+  if (nodes.empty()) {
+    nodes = ParseCpuList(ReadFirstLine("/sys/devices/system/node/online"));
+  }
+  if (nodes.empty()) {
+    nodes.push_back(0);
+  }
+  return nodes;
+}
+
+int NumaNodeOfCpu(int cpu) {
+  const std::map<int, int> &nodes = NodesOfCpus();
+  auto it = nodes.find(cpu);
+  return it == nodes.end() ? 0 : it->second;
+}
+
+int CurrentNumaNode() { return NumaNodeOfCpu(CurrentCpu()); }
+
+int NumaNodeOfAddress(const void *address) {
+#if SAFESIDE_NUMA
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  void *page = reinterpret_cast<void *>(
+      reinterpret_cast<uintptr_t>(address) & ~(page_size - 1));
+  int status = -1;
+  // Without target nodes, move_pages only reports where the pages are.
+  if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) != 0) {
+    return -1;
+  }
+  return status >= 0 ? status : -1;
+#else
+  (void)address;
+  return -1;
+#endif
+}
+
+bool BindToNumaNode(const void *begin, const void *end, int node) {
+#if SAFESIDE_NUMA
+  if (node < 0 || node >= kMaxNodes) {
+    return false;
+  }
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t first = reinterpret_cast<uintptr_t>(begin) & ~(page_size - 1);
+  uintptr_t last = (reinterpret_cast<uintptr_t>(end) + page_size - 1) &
+                   ~(page_size - 1);
+
+  const int kBitsPerWord = 8 * sizeof(unsigned long);
+  unsigned long mask[kMaxNodes / kBitsPerWord] = {};
+  mask[node / kBitsPerWord] = 1UL << (node % kBitsPerWord);
+  // The kernel counts one more node than the mask holds, see mbind(2).
+  return syscall(SYS_mbind, first, last - first, kMpolBind, mask,
+                 kMaxNodes + 1, kMpolMfMove) == 0;
+#else
+  (void)begin;
+  (void)end;
+  (void)node;
+  return false;
+#endif
+}
+
+int OracleNumaNode() {
+  int node = oracle_node.load();
+  return node >= 0 ? node : CurrentNumaNode();
+}
+
+void SetOracleNumaNode(int node) { oracle_node.store(node); }
+
+void PlaceOnOracleNode(const void *begin, const void *end) {
+  static const bool multi_node = NumaNodes().size() > 1;
+  if (multi_node) {
+    BindToNumaNode(begin, end, OracleNumaNode());
+  }
+}
+
+void *AllocateOnOracleNode(size_t bytes) {
+  // Zero bytes still get a page, mmap refuses empty mappings.
+  bytes = std::max<size_t>(bytes, 1);
+#if SAFESIDE_NUMA_MMAP
+  void *memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+  PlaceOnOracleNode(memory, static_cast<char *>(memory) + bytes);
+  return memory;
+#else
+  return ::operator new(bytes);
+#endif
+}
+
+void FreeOnOracleNode(void *memory, size_t bytes) {
+  if (memory == nullptr) {
+    return;
+  }
+#if SAFESIDE_NUMA_MMAP
+  munmap(memory, std::max<size_t>(bytes, 1));
+#else
+  (void)bytes;
+  ::operator delete(memory);
+#endif
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_NUMA_H_
+#define DEMOS_NUMA_H_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Helpers for placing memory on NUMA nodes, with the raw mbind and move_pages
+// system calls so there's no dependency on libnuma.
+//
+// On a multi-socket host, memory lands on the node of the thread that first
+// touches it. A leak that measures an oracle on a remote node includes the
+// cross-socket latency in every miss, and if the probe thread migrates after
+// the oracle was allocated, the gap between hits and misses changes under the
+// calibrated thresholds. So oracles are bound to a node when they are
+// allocated (OracleArena, AllocateOnOracleNode): by default the node of the
+// allocating thread, which CpuIsolation pins first; for measuring cross-socket
+// leakage, any node set with SetOracleNumaNode.
+//
+// Only mappings of their own are bound, never heap ranges: a binding covers
+// whole pages, so on the heap it would also pin the neighbouring allocations
+// and whatever malloc later reuses the pages for, long after the oracle is
+// gone.
+//
+// Linux only. Elsewhere, and on single-node hosts, there is one node, 0, and
+// nothing is bound.
+
+// The nodes that have memory, at least {0}.
+std::vector<int> NumaNodes();
+
+// The NUMA node of `cpu`, 0 if unknown.
+int NumaNodeOfCpu(int cpu);
+
+// The NUMA node of the CPU the calling thread runs on, 0 if unknown.
+int CurrentNumaNode();
+
+// The node holding the page at `address`, or -1 if unknown or the page is
+// not populated yet.
+int NumaNodeOfAddress(const void *address);
+
+// Binds the pages overlapping [begin, end) to `node`: pages not populated
+// yet will be allocated there, populated ones are migrated. The pages may be
+// shared with neighbouring objects, which move along and stay bound after
+// the range is freed. Returns true on success.
+bool BindToNumaNode(const void *begin, const void *end, int node);
+
+// The node oracles are bound to: the one set with SetOracleNumaNode, or by
+// default (-1) the node of the calling thread. Applies to oracles allocated
+// afterwards; existing ones stay where they are until freed.
+int OracleNumaNode();
+void SetOracleNumaNode(int node);
+
+// Binds [begin, end) to OracleNumaNode() if the host has more than one node.
+// The range must be a mapping of its own, see above.
+void PlaceOnOracleNode(const void *begin, const void *end);
+
+// Maps `bytes` of zeroed, page-aligned memory of its own and binds it with
+// PlaceOnOracleNode. Throws std::bad_alloc if the mapping fails. Without
+// mmap, allocates from the heap and binds nothing.
+void *AllocateOnOracleNode(size_t bytes);
+// Releases memory from AllocateOnOracleNode of the same size.
+void FreeOnOracleNode(void *memory, size_t bytes);
+
+// Allocator for containers on the oracle node, e.g. a secret that is read
+// alongside an oracle. Every allocation is a mapping of its own, so use it
+// for few, long-lived containers.
+template <typename T>
+struct OracleNodeAllocator {
+  using value_type = T;
+
+  OracleNodeAllocator() = default;
+  template <typename U>
+  OracleNodeAllocator(const OracleNodeAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(AllocateOnOracleNode(n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t n) { FreeOnOracleNode(p, n * sizeof(T)); }
+};
+
+template <typename T, typename U>
+bool operator==(const OracleNodeAllocator<T> &,
+                const OracleNodeAllocator<U> &) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const OracleNodeAllocator<T> &,
+                const OracleNodeAllocator<U> &) {
+  return false;
+}
+
+// Owns a T constructed in memory from AllocateOnOracleNode. For oracles,
+// which are too big for the stack and must not share pages with the heap.
+template <typename T>
+class OracleNodePtr {
+ public:
+  template <typename... Args>
+  explicit OracleNodePtr(Args &&... args)
+      : object_(new (AllocateOnOracleNode(sizeof(T)))
+                    T(std::forward<Args>(args)...)) {}
+  ~OracleNodePtr() {
+    object_->~T();
+    FreeOnOracleNode(object_, sizeof(T));
+  }
+
+  // Not copyable or movable.
+  OracleNodePtr(const OracleNodePtr &) = delete;
+  OracleNodePtr &operator=(const OracleNodePtr &) = delete;
+
+  T *get() const { return object_; }
+  T &operator*() const { return *object_; }
+  T *operator->() const { return object_; }
+
+ private:
+  T *object_;
+};
+
+#endif  // DEMOS_NUMA_H_
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "oracle_arena.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX || SAFESIDE_MAC
+#  define SAFESIDE_ORACLE_GUARD_PAGES 1
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "asm/measurereadlatency.h"
+#include "instr.h"
+#include "numa.h"
+#include "page_coloring.h"
+#include "utils.h"
+
+const size_t OracleArena::kPages;
+const size_t OracleArena::kLinesPerPage;
+const size_t OracleArena::kColors;
+
+namespace {
+
+// Pages allocated to pick the kPages from.
+const size_t kPoolPages = 2 * OracleArena::kPages;
+
+// The color handed out n-th from an empty arena. Bit-reversing n spreads the
+// first few colors evenly over the page: 0, 32, 16, 48, 8, ... with 64 lines.
+// Colors are even lines, so no two share an adjacent-line pair.
+int NthColor(size_t n) {
+  size_t reversed = 0;
+  for (size_t bit = 1; bit < OracleArena::kColors; bit <<= 1) {
+    reversed = (reversed << 1) | ((n & bit) ? 1 : 0);
+  }
+  return static_cast<int>(2 * reversed);
+}
+
+}  // namespace
+
+OracleArena::OracleArena() {
+  char *pool = nullptr;
+  size_t pool_pages = kPages;
+#if SAFESIDE_ORACLE_GUARD_PAGES
+  // mprotect works in system pages, which may be bigger than kPageBytes.
+  size_t guard_bytes = std::max<size_t>(kPageBytes, sysconf(_SC_PAGESIZE));
+  // The pool is aligned to its size, 2MB with 4KB pages, so that a
+  // transparent huge page can back it. Hence the room to align it in.
+  const size_t pool_bytes = kPoolPages * kPageBytes;
+  mapping_bytes_ = guard_bytes + 2 * pool_bytes + guard_bytes;
+  void *mapping = mmap(nullptr, mapping_bytes_, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping != MAP_FAILED) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(mapping) + guard_bytes;
+    start = (start + pool_bytes - 1) / pool_bytes * pool_bytes;
+    char *data = reinterpret_cast<char *>(start);
+    if (mprotect(data, pool_bytes, PROT_READ | PROT_WRITE) == 0) {
+#  ifdef MADV_HUGEPAGE
+      // Only a hint; without it the colors need pagemap.
+      madvise(data, pool_bytes, MADV_HUGEPAGE);
+#  endif
+      mapping_ = static_cast<char *>(mapping);
+      pool = data;
+      pool_pages = kPoolPages;
+      guarded_ = true;
+    } else {
+      munmap(mapping, mapping_bytes_);
+    }
+  }
+#endif
+  if (!pool) {
+    // A spare page on each side, plus one to align to.
+    heap_.reset(new char[kPageBytes + kPages * kPageBytes + 2 * kPageBytes]);
+    uintptr_t start = reinterpret_cast<uintptr_t>(heap_.get()) + kPageBytes;
+    start = (start + kPageBytes - 1) / kPageBytes * kPageBytes;
+    pool = reinterpret_cast<char *>(start);
+  }
+
+  // Before the first touch, so the pages are allocated on the node.
+  PlaceOnOracleNode(pool, pool + pool_pages * kPageBytes);
+  node_ = OracleNumaNode();
+
+  // It's not important what we write as long as we force *something* to be
+  // written to each page. Otherwise, the pages could all start off mapped to
+  // the same physical page of zeros. Since the cache on modern Intel CPUs is
+  // physically tagged, some elements might map to the same cache line and we
+  // wouldn't observe a timing difference between reading accessed and
+  // unaccessed elements.
+  memset(pool, 0xFF, pool_pages * kPageBytes);
+
+  page_colored_ =
+      PickColoredPages(pool, pool_pages, kPages, kLinesPerPage, &pages_);
+  if (!page_colored_) {
+    pages_.clear();
+    for (size_t page = 0; page < kPages; ++page) {
+      pages_.push_back(pool + page * kPageBytes);
+    }
+  }
+}
+
+OracleArena::~OracleArena() {
+#if SAFESIDE_ORACLE_GUARD_PAGES
+  if (mapping_) {
+    munmap(mapping_, mapping_bytes_);
+  }
+#endif
+}
+
+std::shared_ptr<OracleArena> OracleArena::Acquire(size_t count,
+                                                  std::vector<int> *colors) {
+  if (count > kColors) {
+    return nullptr;
+  }
+
+  // The process-wide arena outlives its users, so that demos constructing an
+  // oracle per leaked byte keep its pages and calibrated line profiles.
+  static std::mutex mutex;
+  static std::shared_ptr<OracleArena> shared;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (shared && shared->node() == OracleNumaNode() &&
+      shared->AcquireColors(count, colors)) {
+    return shared;
+  }
+  std::shared_ptr<OracleArena> fresh(new OracleArena);
+  fresh->AcquireColors(count, colors);
+  if (!shared || shared->node() != fresh->node()) {
+    shared = fresh;
+  }
+  return fresh;
+}
+
+bool OracleArena::AcquireColors(size_t count, std::vector<int> *colors) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<int> acquired;
+  for (size_t n = 0; n < kColors && acquired.size() < count; ++n) {
+    int color = NthColor(n);
+    if (!taken_[color / 2]) {
+      acquired.push_back(color);
+    }
+  }
+  if (acquired.size() < count) {
+    return false;
+  }
+  for (int color : acquired) {
+    taken_[color / 2] = true;
+  }
+  colors->insert(colors->end(), acquired.begin(), acquired.end());
+  return true;
+}
+
+void OracleArena::ReleaseColors(const std::vector<int> &colors) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (int color : colors) {
+    taken_[color / 2] = false;
+  }
+}
+
+std::vector<LatencyProfile> OracleArena::LineProfiles(
+    int color, int core_type, const std::vector<size_t> &pages) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = line_profiles_.find(std::make_pair(color, core_type));
+    if (it != line_profiles_.end()) {
+      return it->second;
+    }
+  }
+  return CalibrateLineProfiles(color, core_type, pages);
+}
+
+// Collects hit and miss latencies for every line, measured the way a scan
+// measures them: hits while all lines are cached, misses in scan order right
+// after a flush.
+std::vector<LatencyProfile> OracleArena::CalibrateLineProfiles(
+    int color, int core_type, const std::vector<size_t> &pages) {
+  const int iterations = 100;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::vector<uint64_t>> hits(kPages), misses(kPages);
+  for (int n = 0; n < iterations; ++n) {
+    for (size_t page : pages) {
+      ForceRead(Line(page, color));
+    }
+    for (size_t page : pages) {
+      hits[page].push_back(MeasureReadLatency(Line(page, color)));
+    }
+
+    for (size_t page : pages) {
+      FlushDataCacheLineNoBarrier(Line(page, color));
+    }
+    MemoryAndSpeculationBarrier();
+    for (size_t page : pages) {
+      misses[page].push_back(MeasureReadLatency(Line(page, color)));
+    }
+  }
+
+  std::vector<LatencyProfile> &profiles =
+      line_profiles_[std::make_pair(color, core_type)];
+  profiles.resize(kPages);
+  for (size_t page : pages) {
+    profiles[page].Calibrate(hits[page], misses[page]);
+  }
+  return profiles;
+}
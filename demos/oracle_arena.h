@@ -0,0 +1,115 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_ORACLE_ARENA_H_
+#define DEMOS_ORACLE_ARENA_H_
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "hardware_constants.h"
+#include "latency_profile.h"
+
+// OracleArena is the memory behind TimingArray and MultiTimingArray: 256
+// pages, one per oracle element. An oracle only needs one cache line per page,
+// so the pages are shared by several oracles, each using a different "color":
+// its element on page p is the line (p + color) % kLinesPerPage. Consecutive
+// pages thus put an oracle's elements into different cache sets, and oracles
+// with different colors never use the same line or, as colors are handed out
+// in pairs of lines, the same adjacent-line prefetch pair. Concurrent leaks
+// through up to kColors oracles cost one set of pages and TLB entries instead
+// of one set each.
+//
+// Where mmap is available, the pages are bracketed by inaccessible guard
+// pages, so nothing else on the heap shares their cache lines or provokes
+// prefetches into them. Elsewhere a spare page on each side does that.
+//
+// The pages are bound to OracleNumaNode() on multi-node hosts, see numa.h.
+//
+// Lines at the same offset of different pages still share L2 and last-level
+// cache sets if the pages have the same physical color (see page_coloring.h).
+// So the arena allocates twice as many pages as it needs and, if their
+// physical colors can be found out, keeps those that give the pages sharing a
+// line offset different L2 colors and spread over the last-level colors.
+//
+// The arena also keeps the LatencyProfiles of the lines, calibrated once per
+// color and core type, so that oracles constructed one after the other (e.g.
+// one per leaked byte) don't pay for the calibration every time.
+//
+// Thread-safe.
+class OracleArena {
+ public:
+  static const size_t kPages = 256;
+  static const size_t kLinesPerPage = kPageBytes / kCacheLineBytes;
+  // Every color takes one line out of a pair of adjacent lines.
+  static const size_t kColors = kLinesPerPage / 2;
+
+  OracleArena();
+  ~OracleArena();
+
+  OracleArena(const OracleArena&) = delete;
+  OracleArena& operator=(const OracleArena&) = delete;
+
+  // Returns an arena with `count` colors acquired for the caller, stored in
+  // `colors`: the process-wide arena if it has that many free and is on
+  // OracleNumaNode(), otherwise a new one. Returns nullptr if `count` exceeds
+  // kColors. The process-wide arena lives until the process exits.
+  static std::shared_ptr<OracleArena> Acquire(size_t count,
+                                              std::vector<int>* colors);
+
+  // Acquires `count` free colors into `colors`, spread as evenly over the
+  // page as the colors already taken allow. Returns false, acquiring none, if
+  // there are fewer free.
+  bool AcquireColors(size_t count, std::vector<int>* colors);
+  void ReleaseColors(const std::vector<int>& colors);
+
+  // The line of color `color` on page `page`.
+  char* Line(size_t page, int color) const {
+    return pages_[page] + (page + color) % kLinesPerPage * kCacheLineBytes;
+  }
+
+  // The profiles of the lines of color `color` on core type `core_type`,
+  // indexed by page. The first call for a color and core type calibrates them
+  // (see CalibrateLineProfiles), reading the lines in the order of `pages`,
+  // the order the caller scans them in. Calibrating disturbs the cache.
+  std::vector<LatencyProfile> LineProfiles(int color, int core_type,
+                                           const std::vector<size_t>& pages);
+  // Calibrates them again, e.g. after a frequency shift, and returns them.
+  std::vector<LatencyProfile> CalibrateLineProfiles(
+      int color, int core_type, const std::vector<size_t>& pages);
+
+  // Whether the pages are bracketed by guard pages.
+  bool guarded() const { return guarded_; }
+
+  // The NUMA node the pages were bound to.
+  int node() const { return node_; }
+
+  // Whether the pages were picked by their physical colors.
+  bool page_colored() const { return page_colored_; }
+
+ private:
+  char* mapping_ = nullptr;
+  size_t mapping_bytes_ = 0;
+  std::unique_ptr<char[]> heap_;
+  std::vector<char*> pages_;
+  bool guarded_ = false;
+  int node_ = 0;
+  bool page_colored_ = false;
+
+  std::mutex mutex_;
+  std::vector<bool> taken_ = std::vector<bool>(kColors);
+  // By color and core type.
+  std::map<std::pair<int, int>, std::vector<LatencyProfile>> line_profiles_;
+};
+
+#endif  // DEMOS_ORACLE_ARENA_H_
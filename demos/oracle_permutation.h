@@ -0,0 +1,27 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_ORACLE_PERMUTATION_H_
+#define DEMOS_ORACLE_PERMUTATION_H_
+
+#include <cstddef>
+
+// A permutation of the 256 byte values, i -> (offset + i * multiplier) % 256,
+// used to keep oracle accesses from forming a pattern hardware prefetchers
+// recognize: TimingArray lays its elements out in memory in this order, and
+// CacheSideChannel scans its oracle in it. The multiplier must be odd, which
+// makes the mapping cover the whole range.
+struct OraclePermutation {
+  size_t multiplier;
+  size_t offset;
+
+  size_t operator()(size_t i) const { return (offset + i * multiplier) % 256; }
+};
+
+#endif  // DEMOS_ORACLE_PERMUTATION_H_
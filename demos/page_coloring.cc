@@ -0,0 +1,206 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "page_coloring.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "hardware_constants.h"
+
+namespace {
+
+// Largest power of two not above `n`, at least 1.
+size_t FloorPowerOfTwo(size_t n) {
+  size_t power = 1;
+  while (power * 2 <= n) {
+    power *= 2;
+  }
+  return power;
+}
+
+// Bytes of anonymous huge pages in the mapping that contains `address`,
+// according to /proc/self/smaps.
+size_t HugePageBytes(const void *address) {
+  uintptr_t target = reinterpret_cast<uintptr_t>(address);
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  bool inside = false;
+  while (std::getline(smaps, line)) {
+    uintptr_t begin, end;
+    char dash;
+    std::stringstream range(line);
+    // Mapping headers start with "begin-end", fields with "Name:".
+    if (line.find(':') > line.find(' ') &&
+        range >> std::hex >> begin >> dash >> end && dash == '-') {
+      inside = begin <= target && target < end;
+    } else if (inside && line.compare(0, 14, "AnonHugePages:") == 0) {
+      std::stringstream value(line.substr(14));
+      size_t kilobytes = 0;
+      value >> kilobytes;
+      return kilobytes * 1024;
+    }
+  }
+  return 0;
+}
+
+// The frame numbers of the pool's pages, from pagemap or, failing that, from
+// the virtual addresses if the pool is within huge pages. Then only the low
+// bits are meaningful, and `*modulus` is set to the range they cover.
+bool PoolFrames(char *pool, size_t pool_pages, std::vector<uint64_t> *frames,
+                uint64_t *modulus) {
+  PhysicalFrames(pool, pool_pages, frames);
+  if (std::find(frames->begin(), frames->end(), 0) == frames->end()) {
+    *modulus = 0;
+    return true;
+  }
+
+  if (HugePageBytes(pool) < pool_pages * kPageBytes) {
+    return false;
+  }
+  // Huge pages are aligned to their size, which is at least the pool's if the
+  // pool is aligned to its own size.
+  uintptr_t start = reinterpret_cast<uintptr_t>(pool);
+  if (start % (pool_pages * kPageBytes) != 0) {
+    return false;
+  }
+  frames->clear();
+  for (size_t i = 0; i < pool_pages; ++i) {
+    frames->push_back(start / kPageBytes + i);
+  }
+  *modulus = pool_pages;
+  return true;
+}
+
+}  // namespace
+
+size_t PageColors(int level) {
+  for (int index = 0; index < 8; ++index) {
+    std::string root = "/sys/devices/system/cpu/cpu0/cache/index" +
+                       std::to_string(index) + "/";
+    std::ifstream level_file(root + "level");
+    int cache_level;
+    if (!(level_file >> cache_level)) {
+      break;
+    }
+    if (cache_level != level) {
+      continue;
+    }
+    std::ifstream sets_file(root + "number_of_sets");
+    std::ifstream line_file(root + "coherency_line_size");
+    size_t sets, line_size;
+    if (sets_file >> sets && line_file >> line_size) {
+      return std::max<size_t>(
+          1, FloorPowerOfTwo(sets) * line_size / kPageBytes);
+    }
+  }
+  return 1;
+}
+
+void PhysicalFrames(const void *address, size_t pages,
+                    std::vector<uint64_t> *frames) {
+  frames->assign(pages, 0);
+#if SAFESIDE_LINUX
+  if (pages == 0) {
+    return;
+  }
+  int fd = open("/proc/self/pagemap", O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  // One 64-bit entry per virtual page of the system's page size: bit 63 is
+  // "present", bits 0-54 the frame number, which reads as 0 for unprivileged
+  // processes. All entries of the range are read at once.
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(address);
+  uintptr_t first = begin / page_size;
+  uintptr_t last = (begin + pages * kPageBytes - 1) / page_size;
+  std::vector<uint64_t> entries(last - first + 1);
+  size_t bytes = entries.size() * sizeof(uint64_t);
+  ssize_t read = pread(fd, entries.data(), bytes, first * sizeof(uint64_t));
+  close(fd);
+  if (read != static_cast<ssize_t>(bytes)) {
+    return;
+  }
+  for (size_t i = 0; i < pages; ++i) {
+    uintptr_t page = begin + i * kPageBytes;
+    uint64_t entry = entries[page / page_size - first];
+    if (!(entry >> 63)) {
+      continue;
+    }
+    // In units of kPageBytes, which may differ from the system's page size.
+    uint64_t frame = entry & ((1ULL << 55) - 1);
+    (*frames)[i] =
+        frame * page_size / kPageBytes + page % page_size / kPageBytes;
+  }
+#else
+  (void)address;
+#endif
+}
+
+uint64_t PhysicalFrame(const void *address) {
+  std::vector<uint64_t> frames;
+  PhysicalFrames(address, 1, &frames);
+  return frames[0];
+}
+
+bool PickColoredPages(char *pool, size_t pool_pages, size_t count,
+                      size_t lines_per_page, std::vector<char *> *pages) {
+  std::vector<uint64_t> frames;
+  uint64_t modulus;
+  if (count > pool_pages || !PoolFrames(pool, pool_pages, &frames, &modulus)) {
+    return false;
+  }
+  uint64_t l2_colors = PageColors(2);
+  uint64_t llc_colors = std::max(PageColors(3), l2_colors);
+  if (modulus != 0) {
+    l2_colors = std::min(l2_colors, modulus);
+    llc_colors = std::min(llc_colors, modulus);
+  }
+
+  // L2 colors used by the pages chosen so far for each line offset, and how
+  // many chosen pages have each last-level color.
+  std::vector<std::vector<bool>> used(
+      lines_per_page, std::vector<bool>(l2_colors, false));
+  std::vector<size_t> llc_uses(llc_colors, 0);
+  std::vector<bool> taken(pool_pages, false);
+
+  pages->clear();
+  for (size_t i = 0; i < count; ++i) {
+    std::vector<bool> &used_here = used[i % lines_per_page];
+    size_t best = pool_pages;
+    size_t best_score = 0;
+    for (size_t page = 0; page < pool_pages; ++page) {
+      if (taken[page]) {
+        continue;
+      }
+      // A repeated L2 color costs more than any imbalance.
+      size_t score = llc_uses[frames[page] % llc_colors] +
+                     (used_here[frames[page] % l2_colors] ? count : 0);
+      if (best == pool_pages || score < best_score) {
+        best = page;
+        best_score = score;
+      }
+    }
+    taken[best] = true;
+    used_here[frames[best] % l2_colors] = true;
+    ++llc_uses[frames[best] % llc_colors];
+    pages->push_back(pool + best * kPageBytes);
+  }
+  return true;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_PAGE_COLORING_H_
+#define DEMOS_PAGE_COLORING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Physical page coloring for oracle memory.
+//
+// L1 caches are indexed by the offset within a page, so spreading oracle
+// elements over different lines of their pages (see OracleArena) puts them in
+// different L1 sets. L2 and last-level caches are indexed by physical address
+// bits above the page offset as well, the page's "color", which virtual
+// addresses don't reveal. Two elements at the same offset in pages of the same
+// color compete for one set, and enough of them evict each other between the
+// gadget and the scan: false misses.
+//
+// Colors come from the physical frame numbers in /proc/self/pagemap, which the
+// kernel only shows to privileged processes. Otherwise, memory inside a
+// transparent huge page has physical low bits equal to its virtual ones, which
+// gives the colors of up to the huge page's number of pages.
+//
+// Linux only. Elsewhere no colors are known.
+
+// Page colors of the cache at `level` (2 or 3) of CPU 0: the bytes of one way
+// divided by the page size, rounded down to a power of two. 1 if unknown.
+size_t PageColors(int level);
+
+// The physical frame number of the populated page at `address`, or 0 if it
+// is unknown.
+uint64_t PhysicalFrame(const void *address);
+
+// The physical frame numbers of the `pages` pages of kPageBytes starting at
+// `address`, as PhysicalFrame, stored in `frames`. Reads pagemap only once.
+void PhysicalFrames(const void *address, size_t pages,
+                    std::vector<uint64_t> *frames);
+
+// Picks `count` of the `pool_pages` pages starting at `pool`, which must be
+// populated, for an oracle that uses line (i + c) % lines_per_page of the
+// i-th page for some c: pages i and j with i % lines_per_page ==
+// j % lines_per_page get different L2 colors where possible, and the pages
+// are spread evenly over the last-level cache colors. Stores the pages in
+// `pages`. Returns false if the colors of the pool are unknown.
+bool PickColoredPages(char *pool, size_t pool_pages, size_t count,
+                      size_t lines_per_page, std::vector<char *> *pages);
+
+#endif  // DEMOS_PAGE_COLORING_H_
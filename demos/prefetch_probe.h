@@ -0,0 +1,70 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_PREFETCH_PROBE_H_
+#define DEMOS_PREFETCH_PROBE_H_
+
+#include <ostream>
+
+#include "oracle_permutation.h"
+
+// Tools for finding out what the hardware prefetchers of the running CPU do,
+// and for choosing the oracle permutations accordingly.
+//
+// A prefetcher that brings an oracle element into the cache without the
+// gadget touching it produces a false hit. TimingArray and CacheSideChannel
+// try to avoid that by putting every element on its own page and by accessing
+// the elements in a scrambled order, but which order works best depends on the
+// prefetchers, e.g. the scan order of CacheSideChannel was changed for the AMD
+// Ryzen 5 PRO 2400G.
+//
+// Example use, at the beginning of `main`:
+//
+//     PrintPrefetcherBehavior(ProbePrefetchers(), std::cout);
+//     SelectOraclePermutation(&std::cout);
+
+// How often each access pattern made a line it didn't touch come from the
+// cache: the fraction of trials, 0.0 to 1.0.
+struct PrefetcherBehavior {
+  // No access at all. The rate of false hits due to noise alone.
+  double baseline;
+  // The other line of an aligned pair of lines after reading one of them.
+  double adjacent_line;
+  // The line two past the end of an ascending run of consecutive lines.
+  double stream;
+  // The next line of a run with a constant stride of several lines.
+  double stride;
+  // The first line of the next page after a run to the end of a page.
+  double next_page;
+};
+
+// Runs every pattern a few hundred times on a scratch buffer.
+PrefetcherBehavior ProbePrefetchers();
+
+void PrintPrefetcherBehavior(const PrefetcherBehavior &behavior,
+                             std::ostream &out);
+
+// Fraction of `trials` single-element leaks through a TimingArray laid out
+// with `permutation` that find an element other than the one that was read.
+double TimingArrayFalsePositiveRate(const OraclePermutation &permutation,
+                                    int trials);
+
+// Fraction of `trials` CacheSideChannel rounds, scanned in `order`, that
+// decode a hit other than the one that was read.
+double CacheSideChannelFalsePositiveRate(const OraclePermutation &order,
+                                         int trials);
+
+// Ranks a set of candidate permutations, including the current defaults, by
+// the two false-positive rates above. Installs the best one for each channel
+// with TimingArray::SetDefaultPermutation and CacheSideChannel::SetScanOrder.
+// A candidate replaces the default only if it is strictly better. Writes the
+// ranking to `log` unless it is nullptr.
+void SelectOraclePermutation(std::ostream *log = nullptr);
+
+#endif  // DEMOS_PREFETCH_PROBE_H_
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "realtime.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX
+#  include <sched.h>
+#  include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "cpu_isolation.h"
+#include "instr.h"
+
+namespace {
+
+// Returns the total number of interrupts the given CPU has handled, summed
+// over all sources listed in /proc/interrupts, or 0 if unknown.
+uint64_t ProcInterruptsForCpu(int cpu) {
+  std::ifstream in("/proc/interrupts");
+  std::string line;
+  if (cpu < 0 || !std::getline(in, line)) {
+    return 0;
+  }
+
+  // The header lists online CPUs only, so find our column by name.
+  std::stringstream header(line);
+  std::string name;
+  int column = -1;
+  for (int i = 0; header >> name; ++i) {
+    if (name == "CPU" + std::to_string(cpu)) {
+      column = i;
+      break;
+    }
+  }
+  if (column == -1) {
+    return 0;
+  }
+
+  uint64_t total = 0;
+  while (std::getline(in, line)) {
+    // Each line is "<source>: <count per CPU> ... <description>". Some lines,
+    // e.g. "ERR:", only have a single count; skip those.
+    std::stringstream ss(line);
+    std::string source, count;
+    ss >> source;
+    for (int i = 0; i <= column && ss >> count; ++i) {
+      if (count.empty() || !isdigit(static_cast<unsigned char>(count[0]))) {
+        break;
+      }
+      if (i == column) {
+        total += std::stoull(count);
+      }
+    }
+  }
+  return total;
+}
+
+}  // namespace
+
+RealtimeMode::RealtimeMode() {
+#if SAFESIDE_LINUX
+  // Remember the current policy so we can restore it.
+  previous_policy_ = sched_getscheduler(0);
+  sched_param param;
+  if (sched_getparam(0, &param) == 0) {
+    previous_priority_ = param.sched_priority;
+  }
+
+  // The lowest real-time priority is already above every SCHED_OTHER thread.
+  // Going higher would only starve the kernel's own real-time threads.
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+  fifo_ = sched_setscheduler(0, SCHED_FIFO, &param) == 0;
+
+  memory_locked_ = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#endif
+}
+
+RealtimeMode::~RealtimeMode() {
+#if SAFESIDE_LINUX
+  if (memory_locked_) {
+    munlockall();
+  }
+  if (fifo_) {
+    sched_param param;
+    param.sched_priority = previous_priority_;
+    sched_setscheduler(0, previous_policy_, &param);
+  }
+#endif
+}
+
+void RealtimeMode::PrintReport(std::ostream &out) const {
+  out << "Real-time mode: SCHED_FIFO " << (fifo_ ? "on" : "not permitted")
+      << ", memory " << (memory_locked_ ? "locked" : "not locked")
+      << std::endl;
+}
+
+InterruptDetector::InterruptDetector(bool watch_proc_interrupts)
+    : watch_proc_interrupts_(watch_proc_interrupts) {}
+
+void InterruptDetector::BeginRound() {
+  round_cpu_ = CurrentCpu();
+  if (watch_proc_interrupts_) {
+    round_interrupts_ = ProcInterruptsForCpu(round_cpu_);
+  }
+}
+
+void InterruptDetector::BeginScan() {
+  MemoryAndSpeculationBarrier();
+  scan_start_ = ReadTimestampCounter();
+}
+
+bool InterruptDetector::EndScan(const uint64_t *latencies, size_t count) {
+  MemoryAndSpeculationBarrier();
+  uint64_t scan_ticks = ReadTimestampCounter() - scan_start_;
+  ++rounds_;
+
+  uint64_t latency_sum = 0, max_latency = 0;
+  for (size_t i = 0; i < count; ++i) {
+    latency_sum += latencies[i];
+    max_latency = std::max(max_latency, latencies[i]);
+  }
+
+  bool interrupted = false;
+
+  // Timestamp gap between probes. Each read comes with some fixed overhead
+  // outside the timed window (the call, fences, loop bookkeeping). Allow twice
+  // the smallest overhead we've seen per read, plus some slack for the scan as
+  // a whole. Servicing even the cheapest interrupt takes on the order of a
+  // microsecond, i.e. thousands of ticks on a GHz timestamp counter, which is
+  // well above both.
+  const uint64_t scan_slack = 1000;
+  if (count > 0) {
+    uint64_t overhead = scan_ticks > latency_sum ? scan_ticks - latency_sum : 0;
+    min_overhead_per_read_ = std::min(min_overhead_per_read_, overhead / count);
+    if (overhead > 2 * min_overhead_per_read_ * count + scan_slack) {
+      interrupted = true;
+    }
+  }
+
+  // Probe outlier. The smallest per-scan maximum is a conservative bound on
+  // an undisturbed miss. Page walks that themselves miss the cache can make a
+  // read several times slower than that, but only a disturbance makes it 32x
+  // slower. Short scans (e.g. a TimingArray scan that stopped at an early hit)
+  // may not include any miss, so they don't count towards the bound.
+  const size_t min_reads_for_miss_bound = 64;
+  if (count >= min_reads_for_miss_bound) {
+    min_max_latency_ = std::min(min_max_latency_, max_latency);
+  }
+  if (min_max_latency_ != UINT64_MAX && max_latency > 32 * min_max_latency_) {
+    interrupted = true;
+  }
+
+  // Migration.
+  if (round_cpu_ != -1 && CurrentCpu() != round_cpu_) {
+    interrupted = true;
+  }
+
+  if (watch_proc_interrupts_ && round_cpu_ != -1 &&
+      ProcInterruptsForCpu(round_cpu_) != round_interrupts_) {
+    interrupted = true;
+  }
+
+  if (interrupted) {
+    ++discarded_rounds_;
+  }
+  return interrupted;
+}
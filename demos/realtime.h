@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_REALTIME_H_
+#define DEMOS_REALTIME_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// RealtimeMode is an opt-in measurement mode that makes it less likely for the
+// OS to disturb timed reads. For as long as the object lives, it:
+//   - Runs the calling thread under the SCHED_FIFO real-time policy, so it is
+//     no longer preempted by ordinary (SCHED_OTHER) threads.
+//   - Locks all current and future memory of the process (`mlockall`), so
+//     oracles and the stack can't be paged out or hit minor faults mid-leak.
+//
+// Both usually need privileges (root, CAP_SYS_NICE/CAP_IPC_LOCK or suitable
+// rlimits). Whatever isn't permitted is skipped; check `fifo()` and
+// `memory_locked()` to see what took effect.
+//
+// The thread stays preemptible by interrupts and by the kernel's real-time
+// throttling (by default 5% of every second is reserved for other threads),
+// which is what InterruptDetector below is for.
+class RealtimeMode {
+ public:
+  RealtimeMode();
+  ~RealtimeMode();
+
+  RealtimeMode(const RealtimeMode&) = delete;
+  RealtimeMode& operator=(const RealtimeMode&) = delete;
+
+  bool fifo() const { return fifo_; }
+  bool memory_locked() const { return memory_locked_; }
+
+  // Writes a one-line human-readable summary of the above.
+  void PrintReport(std::ostream& out) const;
+
+ private:
+  bool fifo_ = false;
+  bool memory_locked_ = false;
+  int previous_policy_ = 0;
+  int previous_priority_ = 0;
+};
+
+// InterruptDetector recognizes measurement rounds that were probably disturbed
+// by an interrupt or preemption so the caller can discard them instead of
+// scoring them. MeasureReadLatency returns spuriously high values when that
+// happens during the timed read, and an interrupt handler between reads can
+// evict oracle lines, making genuine hits look like misses.
+//
+// A round is flagged when any of these is true:
+//   - A timestamp gap: the time spent in the whole scan exceeds the sum of the
+//     individual read latencies by noticeably more than the usual per-read
+//     overhead, i.e. something ran between two probes.
+//   - A probe outlier: a single read took far longer than even a read from
+//     DRAM can, i.e. something ran during the probe.
+//   - The thread migrated to another CPU during the round.
+//   - Optionally, the current CPU's counts in /proc/interrupts changed during
+//     the round. This catches interrupts that hit the gadget phase rather than
+//     the scan, but reading the file costs tens of microseconds per round.
+//
+// Side-channel classes call the three hooks when a detector is attached to
+// them (see `SetInterruptDetector`):
+//
+//     BeginRound();  // when flushing the oracle
+//     ...            // speculative gadget runs
+//     BeginScan();   // right before the first timed read
+//     ...            // timed reads, collecting latencies
+//     if (EndScan(latencies, n)) { /* discard the round */ }
+class InterruptDetector {
+ public:
+  explicit InterruptDetector(bool watch_proc_interrupts = false);
+
+  InterruptDetector(const InterruptDetector&) = delete;
+  InterruptDetector& operator=(const InterruptDetector&) = delete;
+
+  void BeginRound();
+  void BeginScan();
+
+  // Returns true if the round should be discarded. `latencies` are the
+  // `count` values returned by MeasureReadLatency during the scan.
+  bool EndScan(const uint64_t* latencies, size_t count);
+
+  uint64_t rounds() const { return rounds_; }
+  uint64_t discarded_rounds() const { return discarded_rounds_; }
+
+ private:
+  bool watch_proc_interrupts_;
+
+  int round_cpu_ = -1;
+  uint64_t round_interrupts_ = 0;
+  uint64_t scan_start_ = 0;
+
+  // Smallest per-read overhead (scan time not spent inside timed reads) seen
+  // so far, in timestamp ticks.
+  uint64_t min_overhead_per_read_ = UINT64_MAX;
+  // Smallest maximum read latency seen so far in a long enough scan, i.e. a
+  // conservative estimate of how slow an undisturbed cache miss is.
+  uint64_t min_max_latency_ = UINT64_MAX;
+
+  uint64_t rounds_ = 0;
+  uint64_t discarded_rounds_ = 0;
+};
+
+#endif  // DEMOS_REALTIME_H_
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "reliable_leak.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Accuracy of a channel whose votes are pure noise.
+constexpr double kChanceAccuracy = 1.0 / 256;
+
+// Highest accuracy we ever assume, so that a single vote is never enough for
+// the default target, however clean the channel looked so far.
+constexpr double kMaxAccuracy = 0.99;
+
+// Pairs of votes at chance agreement that every byte's estimate starts from.
+// A byte that has only seen two agreeing votes may just be a noisy one that
+// got lucky, so it has to show more agreement before it is trusted.
+constexpr double kPriorPairs = 2;
+
+// The probability that two votes agree if each is right with probability p:
+//     a = p^2 + (1 - p)^2 / 255
+// (both right, or both wrong in the same way), solved for p. Unlike counting
+// votes for the best value, this isn't biased towards 1 when bytes have few
+// votes.
+double AccuracyOf(double agreement) {
+  if (agreement <= kChanceAccuracy) {
+    return kChanceAccuracy;
+  }
+  double accuracy = (1 + std::sqrt(255 * (256 * agreement - 1))) / 256;
+  return std::min(accuracy, kMaxAccuracy);
+}
+
+// Estimates the probability that a vote for `byte` is right from how often
+// two of its votes agree. Bytes differ, e.g. when some share an oracle line
+// with the victim's own accesses, so an estimate across all bytes would
+// overstate the confidence of the noisy ones.
+double EstimateAccuracy(const ByteVotes& byte) {
+  double agreeing_pairs = 0;
+  for (int value = 0; value < 256; ++value) {
+    agreeing_pairs += byte.votes(value) * (byte.votes(value) - 1.0);
+  }
+  double pairs = byte.total_votes() * (byte.total_votes() - 1.0);
+  return AccuracyOf((agreeing_pairs + kPriorPairs * kChanceAccuracy) /
+                    (pairs + kPriorPairs));
+}
+
+}  // namespace
+
+void ByteVotes::Add(int value) {
+  ++rounds_;
+  if (value < 0 || value > 255) {
+    return;
+  }
+  ++votes_[value];
+  ++total_votes_;
+  if (best_ == -1 || votes_[value] > votes_[best_]) {
+    best_ = value;
+  }
+}
+
+double ByteVotes::Confidence(double accuracy) const {
+  if (best_ == -1) {
+    return kChanceAccuracy;
+  }
+  accuracy = std::min(std::max(accuracy, kChanceAccuracy), kMaxAccuracy);
+
+  // Every vote for value u makes "u is the actual value" more likely than
+  // "some other value is" by the factor accuracy / ((1 - accuracy) / 255).
+  // The posterior of best_ against a uniform prior is therefore
+  //     1 / sum_u factor^(votes[u] - votes[best_]).
+  double log_factor = std::log(accuracy * 255 / (1 - accuracy));
+  double sum = 0;
+  for (int value = 0; value < 256; ++value) {
+    sum += std::exp((votes_[value] - votes_[best_]) * log_factor);
+  }
+  return 1 / sum;
+}
+
+std::vector<LeakedByte> ReliableLeak(size_t size,
+                                     const ObserveFunction& observe,
+                                     const ReliableLeakOptions& options) {
+  std::vector<ByteVotes> votes(size);
+  std::vector<bool> done(size, false);
+  std::vector<double> accuracies(size, options.vote_accuracy);
+
+  size_t remaining = size;
+  for (int pass = 0; remaining > 0; ++pass) {
+    int rounds = std::max(
+        1, pass == 0 ? options.initial_rounds : options.rounds_per_pass);
+    for (size_t i = 0; i < size; ++i) {
+      for (int round = 0; !done[i] && round < rounds; ++round) {
+        votes[i].Add(observe(i));
+      }
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+      if (options.vote_accuracy <= 0) {
+        accuracies[i] = EstimateAccuracy(votes[i]);
+      }
+      if (!done[i] &&
+          (votes[i].Confidence(accuracies[i]) >= options.target_confidence ||
+           votes[i].rounds() >= options.max_rounds_per_byte)) {
+        done[i] = true;
+        --remaining;
+      }
+    }
+  }
+
+  std::vector<LeakedByte> leaked(size);
+  for (size_t i = 0; i < size; ++i) {
+    leaked[i].value = votes[i].best();
+    leaked[i].confidence = votes[i].Confidence(accuracies[i]);
+    leaked[i].rounds = votes[i].rounds();
+  }
+  return leaked;
+}
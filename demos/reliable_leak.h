@@ -0,0 +1,108 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_RELIABLE_LEAK_H_
+#define DEMOS_RELIABLE_LEAK_H_
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// An optional layer for leaking many bytes, built on single observations from
+// any side-channel (e.g. TimingArray::FindFirstCachedElementIndex or
+// CacheSideChannel::FindAccessedIndex).
+//
+// The usual way to leak a byte is to repeat rounds until one value wins by a
+// fixed margin (see CacheSideChannel::RecomputeScores). That spends the same
+// effort on every byte, and a byte that still comes out wrong is silently
+// wrong. Instead, ReliableLeak treats every round as a noisy vote, computes for
+// each byte the probability that its best value is right, and keeps re-leaking
+// only the bytes whose probability is below a target. Clean bytes finish after
+// a couple of rounds, noisy ones get as many rounds as they need, and every
+// byte is reported with its confidence so the caller knows which ones to
+// distrust.
+//
+// Example use:
+//
+//     TimingArray ta;
+//     std::vector<LeakedByte> leaked = ReliableLeak(
+//         secret_size, [&](size_t offset) {
+//           ta.FlushFromCache();
+//           // ... gadget accesses ta[secret[offset]] ...
+//           return ta.FindFirstCachedElementIndex();
+//         });
+
+// Runs one side-channel round for the byte at `offset` and returns the value
+// observed in the cache, or -1 if the round was inconclusive.
+using ObserveFunction = std::function<int(size_t offset)>;
+
+// Votes collected for one byte.
+class ByteVotes {
+ public:
+  // Records one round. -1 (an inconclusive round) counts as a round but not as
+  // a vote.
+  void Add(int value);
+
+  int rounds() const { return rounds_; }
+  int total_votes() const { return total_votes_; }
+  int votes(int value) const { return votes_[value]; }
+
+  // Value with the most votes, -1 if there are none.
+  int best() const { return best_; }
+
+  // Probability that best() is the byte's actual value, assuming that every
+  // vote is right with probability `accuracy` and otherwise any of the 255
+  // wrong values with equal probability. That's a soft decision: a 5-to-1
+  // split is much less convincing than a 5-to-0 one.
+  double Confidence(double accuracy) const;
+
+ private:
+  std::array<int, 256> votes_ = {};
+  int rounds_ = 0;
+  int total_votes_ = 0;
+  int best_ = -1;
+};
+
+struct LeakedByte {
+  // Best value, or -1 if no round was conclusive.
+  int value = -1;
+  // Probability that `value` is right, see ByteVotes::Confidence.
+  double confidence = 0;
+  // Rounds spent on this byte.
+  int rounds = 0;
+};
+
+struct ReliableLeakOptions {
+  // A byte is done once its confidence reaches this.
+  double target_confidence = 0.999;
+  // Rounds every byte gets before confidence is first looked at. 1 lets clean
+  // bytes finish as early as possible; more gives a better estimate of the
+  // channel accuracy.
+  int initial_rounds = 1;
+  // Rounds added to each unfinished byte per pass over the bytes.
+  int rounds_per_pass = 1;
+  // A byte is given up on after this many rounds and keeps whatever
+  // confidence it reached.
+  int max_rounds_per_byte = 10000;
+  // Probability that a single vote is right. 0 estimates it for each byte
+  // from how well the byte's own votes agree so far, which is what you want
+  // unless the channel is known.
+  double vote_accuracy = 0;
+};
+
+// Leaks `size` bytes, observing byte i with `observe(i)`.
+//
+// Goes over the bytes in passes so that noise bursts are spread across many
+// bytes instead of hitting all rounds of one byte.
+std::vector<LeakedByte> ReliableLeak(
+    size_t size, const ObserveFunction& observe,
+    const ReliableLeakOptions& options = ReliableLeakOptions());
+
+#endif  // DEMOS_RELIABLE_LEAK_H_
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "reliable_leak.h"
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Leak a secret through a simulated, deterministic channel and check that
+// ReliableLeak reaches the target error rate, spends its rounds on the noisy
+// bytes, and reports confidence that matches reality.
+namespace {
+
+uint64_t state = 0x9E3779B97F4A7C15ull;
+
+// Uniform in [0, 1).
+double Random() {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return (state >> 11) * (1.0 / (1ull << 53));
+}
+
+}  // namespace
+
+int main() {
+  const size_t kBytes = 4096;
+  // One byte in eight is much noisier, e.g. because it shares the oracle line
+  // with something the victim touches anyway.
+  const double kCleanAccuracy = 0.6, kNoisyAccuracy = 0.2;
+  const double kInconclusive = 0.2;
+
+  std::vector<int> secret;
+  for (size_t i = 0; i < kBytes; ++i) {
+    secret.push_back(static_cast<int>(Random() * 256));
+  }
+  auto noisy = [](size_t offset) { return offset % 8 == 0; };
+
+  ReliableLeakOptions options;
+  std::vector<LeakedByte> leaked = ReliableLeak(
+      kBytes,
+      [&](size_t offset) {
+        double accuracy = noisy(offset) ? kNoisyAccuracy : kCleanAccuracy;
+        double r = Random();
+        if (r < kInconclusive) {
+          return -1;
+        }
+        if (r < kInconclusive + accuracy) {
+          return secret[offset];
+        }
+        return static_cast<int>(Random() * 256);
+      },
+      options);
+
+  int errors = 0;
+  double expected_errors = 0;
+  long clean_rounds = 0, noisy_rounds = 0;
+  for (size_t i = 0; i < kBytes; ++i) {
+    if (leaked[i].value != secret[i]) {
+      ++errors;
+    }
+    expected_errors += 1 - leaked[i].confidence;
+    (noisy(i) ? noisy_rounds : clean_rounds) += leaked[i].rounds;
+  }
+  double clean_average = clean_rounds / (kBytes * 7.0 / 8);
+  double noisy_average = noisy_rounds / (kBytes / 8.0);
+
+  std::cout << "Wrong bytes: " << errors << " of " << kBytes
+            << ", expected from confidence " << expected_errors << std::endl;
+  std::cout << "Average rounds per clean byte: " << clean_average << std::endl;
+  std::cout << "Average rounds per noisy byte: " << noisy_average << std::endl;
+
+  // At the target confidence we expect about 4 wrong bytes. The noisy bytes
+  // should get several times the rounds of the clean ones, and clean bytes
+  // should need far fewer than the 40+ that the fixed score margin in
+  // CacheSideChannel takes.
+  bool pass = errors <= 3 * (1 - options.target_confidence) * kBytes &&
+              errors <= 3 * expected_errors + 1 &&
+              noisy_average > 2 * clean_average && clean_average < 8;
+  return !pass;
+}
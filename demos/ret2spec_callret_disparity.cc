@@ -16,9 +16,10 @@
 #include "local_content.h"
 #include "utils.h"
 
-// Global variable stores for avoiding to pass data through function arguments.
-size_t current_offset;
-const std::array<BigByte, 256> *oracle_ptr;
+// Thread-local stores for avoiding to pass data through function arguments.
+// Each thread leaking with its own CacheSideChannel gets its own copy.
+thread_local size_t current_offset;
+thread_local const std::array<BigByte, 256> *oracle_ptr;
 
 #if SAFESIDE_ARM64
 // On ARM we need a local function to return to because of local vs. global
@@ -36,19 +36,20 @@
 // excessively high because of the possibility of stack overflow.
 constexpr size_t kRecursionDepth = 64;
 
-// Global variables used to avoid passing parameters through recursive function
-// calls. Since we flush whole stack frames from the cache, it is important not
-// to store on stack any data that might be affected by being flushed from
-// cache.
-size_t current_offset;
-const std::array<BigByte, 256> *oracle_ptr;
+// Thread-local variables used to avoid passing parameters through recursive
+// function calls. Since we flush whole stack frames from the cache, it is
+// important not to store on stack any data that might be affected by being
+// flushed from cache. Being thread-local, each thread leaking with its own
+// CacheSideChannel gets its own copy.
+thread_local size_t current_offset;
+thread_local const std::array<BigByte, 256> *oracle_ptr;
 
 // Return value of ReturnsFalse that never changes. Avoiding compiler
 // optimizations with it.
 bool false_value = false;
 // Pointers to stack marks in ReturnsTrue. Used for flushing the return address
 // from the cache.
-std::vector<char *> stack_mark_pointers;
+thread_local std::vector<char *> stack_mark_pointers;
 
 // Always returns false.
 static bool ReturnsFalse(int counter) {
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * Standalone background load generator. Runs one of the NoiseGenerator
+ * profiles for a while, so that any demo or benchmark can be run under
+ * realistic noise from a second terminal:
+ *
+ *     ./safeside_noise llc-thrash 2 60 &
+ *     ./spectre_v1_pht_sa
+ *
+ * For sibling profiles, the noise is placed relative to the CPU this process
+ * starts on; use `taskset` to start it on the core you measure on.
+ **/
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "noise_generator.h"
+
+static void PrintUsage(const char *argv0) {
+  std::cerr << "Usage: " << argv0 << " <profile> [threads] [seconds]"
+            << std::endl
+            << "Profiles:";
+  for (NoiseProfile profile : AllNoiseProfiles()) {
+    std::cerr << " " << NoiseProfileName(profile);
+  }
+  std::cerr << std::endl
+            << "Runs 1 thread for 10 seconds by default. 0 seconds runs until "
+               "killed."
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  NoiseProfile profile;
+  if (argc < 2 || !ParseNoiseProfile(argv[1], &profile)) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  int threads = argc > 2 ? std::atoi(argv[2]) : 1;
+  int seconds = argc > 3 ? std::atoi(argv[3]) : 10;
+
+  NoiseGenerator noise(profile, threads);
+  std::cout << "Running " << NoiseProfileName(profile) << " with " << threads
+            << " thread(s), " << noise.pinned_threads() << " pinned"
+            << std::endl;
+
+  if (seconds == 0) {
+    for (;;) {
+      std::this_thread::sleep_for(std::chrono::hours(1));
+    }
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+}
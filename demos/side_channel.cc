@@ -0,0 +1,31 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "side_channel.h"
+
+#include <algorithm>
+
+void ThresholdClassifier::Calibrate(std::vector<uint64_t> hits,
+                                    std::vector<uint64_t> misses) {
+  std::sort(hits.begin(), hits.end());
+  std::sort(misses.begin(), misses.end());
+  uint64_t slow_hit = hits[hits.size() * 9 / 10];
+  uint64_t fast_miss = misses[misses.size() / 10];
+  threshold_ =
+      slow_hit < fast_miss ? slow_hit + (fast_miss - slow_hit) / 2 : slow_hit;
+}
+
+std::pair<bool, int> ScoreDecider::Add(int hit,
+                                       const std::array<uint64_t, 256> &,
+                                       int) {
+  if (hit != -1) {
+    ++scores_[hit];
+  }
+  return CacheSideChannel::DecideScores(scores_);
+}
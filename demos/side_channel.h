@@ -0,0 +1,340 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_SIDE_CHANNEL_H_
+#define DEMOS_SIDE_CHANNEL_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "asm/measurereadlatency.h"
+#include "cache_sidechannel.h"
+#include "instr.h"
+#include "numa.h"
+#include "oracle_permutation.h"
+#include "realtime.h"
+#include "soft_decoder.h"
+#include "timing_array.h"
+#include "utils.h"
+
+// SideChannel is a cache timing side-channel assembled from four policies,
+// so that the layouts, timers and decoders of TimingArray and
+// CacheSideChannel can be combined freely and benchmarked against each other
+// (see channel_benchmark).
+//
+//   Layout      where the 256 oracle elements live and in which order a scan
+//               reads them. Provides
+//                   using ElementType = ...;
+//                   ElementType &operator[](size_t i);
+//                   size_t ScanIndex(size_t n) const;  // n-th element read
+//   Timer       how a read is timed. Provides
+//                   static uint64_t Measure(const void *address);
+//   Classifier  which element, if any, a scan saw cached. Provides
+//                   // Hit and miss latencies measured with the Timer.
+//                   void Calibrate(const std::vector<uint64_t> &hits,
+//                                  const std::vector<uint64_t> &misses);
+//                   void BeginScan();
+//                   // Called after every read; true ends the scan early.
+//                   bool Observe(size_t i, uint64_t latency, int reference);
+//                   int Classify(const std::array<uint64_t, 256> &latencies,
+//                                int reference);
+//   Decider     when the observations of several rounds settle a byte.
+//               Provides
+//                   void Reset();
+//                   // `hit` is the Classify() result of a round, and
+//                   // `latencies` what the scan measured (0 if not read).
+//                   std::pair<bool, int> Add(
+//                       int hit, const std::array<uint64_t, 256> &latencies,
+//                       int reference);
+//
+// `reference` is an element the caller read architecturally in the round, or
+// -1 if there is none. It is never reported as the hit; MedianClassifier
+// requires it.
+//
+// ScoringChannel below is CacheSideChannel as a configuration: the same
+// oracle, scan order, hit rule (CacheSideChannel::DecodeLatencies) and
+// decision rule (CacheSideChannel::DecideScores).
+//
+// TimingArrayChannel is only an approximation of TimingArray, for comparing
+// policies. It shares the layout and the first-hit decision, but:
+//   - ThresholdClassifier calibrates its single threshold from the Timer (the
+//     midpoint of the 90th percentile of hits and the 10th of misses), since
+//     TimingArray's rule only works with MeasureReadLatency;
+//   - it has no per-line LatencyProfiles, and does not recalibrate for core
+//     types or frequency shifts;
+//   - like every SideChannel, it is used with a reference hit each round,
+//     which TimingArray doesn't need. ThresholdClassifier skips it, but the
+//     extra read and the scan past it cost time.
+// Leaks that need TimingArray's accuracy should use TimingArray itself.
+//
+// SoftDecoder is a third decider, which decodes the latencies themselves
+// rather than the classifier's hits.
+//
+// Example use:
+//
+//     ScoringChannel channel;
+//     std::pair<bool, int> result;
+//     do {
+//       channel.FlushOracle();
+//       int reference = channel.AddReferenceHit();
+//       ForceRead(&channel[secret]);  // Usually speculatively.
+//       result = channel.MeasureRound(reference);
+//     } while (!result.first);
+//     channel.NextByte();
+
+// TimingArray's layout: each element on its own page plus a cache line, laid
+// out in memory in the order of TimingArray::DefaultPermutation() and read in
+// index order.
+class TimingArrayLayout {
+ public:
+  using ElementType = TimingArray::ValueType;
+
+  ElementType &operator[](size_t i) { return array_[i]; }
+  size_t ScanIndex(size_t n) const { return n; }
+
+ private:
+  TimingArray array_;
+};
+
+// CacheSideChannel's layout: page-sized BigBytes in index order, read in the
+// order of CacheSideChannel::ScanOrder().
+class BigByteLayout {
+ public:
+  using ElementType = BigByte;
+
+  ElementType &operator[](size_t i) { return oracle_->oracles_[i]; }
+  size_t ScanIndex(size_t n) const { return scan_order_(n); }
+
+ private:
+  // Too big for the stack on some platforms, see CacheSideChannel.
+  OracleNodePtr<PaddedOracleArray> oracle_;
+  OraclePermutation scan_order_ = CacheSideChannel::ScanOrder();
+};
+
+// Times reads with MeasureReadLatency, the platform-specific assembly.
+struct ReadLatencyTimer {
+  static uint64_t Measure(const void *address) {
+    return MeasureReadLatency(address);
+  }
+};
+
+// Times reads with ReadTimestampCounter between full barriers. Coarser than
+// MeasureReadLatency, but needs no assembly.
+struct TimestampTimer {
+  static uint64_t Measure(const void *address) {
+    MemoryAndSpeculationBarrier();
+    uint64_t start = ReadTimestampCounter();
+    MemoryAndSpeculationBarrier();
+    ForceRead(address);
+    MemoryAndSpeculationBarrier();
+    return ReadTimestampCounter() - start;
+  }
+};
+
+// TimingArray's classification, simplified: the first element read at or
+// below a single threshold. The scan stops there. The threshold is halfway
+// between the 90th percentile of hits and the 10th percentile of misses,
+// which unlike TimingArray's calibration works with any Timer. See above for
+// what TimingArray does beyond this.
+class ThresholdClassifier {
+ public:
+  void Calibrate(std::vector<uint64_t> hits, std::vector<uint64_t> misses);
+  void BeginScan() { found_ = -1; }
+  bool Observe(size_t i, uint64_t latency, int reference) {
+    if (static_cast<int>(i) != reference && latency <= threshold_) {
+      found_ = static_cast<int>(i);
+      return true;
+    }
+    return false;
+  }
+  int Classify(const std::array<uint64_t, 256> &, int) const { return found_; }
+
+ private:
+  uint64_t threshold_ = 0;
+  int found_ = -1;
+};
+
+// CacheSideChannel's classification: the single element faster than halfway
+// between the median and the reference, see CacheSideChannel::DecodeLatencies.
+// Reads every element.
+struct MedianClassifier {
+  void Calibrate(const std::vector<uint64_t> &,
+                 const std::vector<uint64_t> &) {}
+  void BeginScan() {}
+  bool Observe(size_t, uint64_t, int) { return false; }
+  int Classify(const std::array<uint64_t, 256> &latencies,
+               int reference) const {
+    return CacheSideChannel::DecodeLatencies(latencies,
+                                             static_cast<char>(reference));
+  }
+};
+
+// TimingArray's decision: the first hit settles the byte.
+struct FirstHitDecider {
+  void Reset() {}
+  std::pair<bool, int> Add(int hit, const std::array<uint64_t, 256> &, int) {
+    return std::make_pair(hit != -1, hit);
+  }
+};
+
+// CacheSideChannel's decision: hits are counted, and the byte is settled by
+// CacheSideChannel::DecideScores.
+class ScoreDecider {
+ public:
+  void Reset() { scores_.fill(0); }
+  std::pair<bool, int> Add(int hit, const std::array<uint64_t, 256> &, int);
+
+ private:
+  std::array<int, 257> scores_ = {};
+};
+
+template <typename Layout, typename Timer, typename Classifier,
+          typename Decider>
+class SideChannel {
+ public:
+  using ElementType = typename Layout::ElementType;
+  static const size_t kElements = 256;
+
+  SideChannel() { Calibrate(); }
+
+  SideChannel(const SideChannel &) = delete;
+  SideChannel &operator=(const SideChannel &) = delete;
+
+  // The oracle element for value `i`.
+  ElementType &operator[](size_t i) { return layout_[i]; }
+
+  // Flushes all elements from the cache.
+  void FlushOracle() {
+    for (size_t i = 0; i < kElements; ++i) {
+      FlushDataCacheLineNoBarrier(&layout_[i]);
+    }
+    MemoryAndSpeculationBarrier();
+
+    if (interrupt_detector_) {
+      interrupt_detector_->BeginRound();
+    }
+  }
+
+  // Reads an element architecturally, a different one every call, and
+  // returns its index to pass as `reference`. The references rotate over the
+  // oracle in scan order, which for BigByteLayout is the rotation of
+  // CacheSideChannel::AddHitAndRecomputeScores.
+  int AddReferenceHit() {
+    int reference = static_cast<int>(layout_.ScanIndex(reference_counter_));
+    reference_counter_ = (reference_counter_ + 1) % kElements;
+    ForceRead(&layout_[reference]);
+    return reference;
+  }
+
+  // Scans the oracle and returns the element other than `reference` that the
+  // classifier saw cached, or -1. Also -1 if the attached InterruptDetector
+  // flags the round as disturbed.
+  int FindAccessedIndex(int reference) {
+    std::array<uint64_t, kElements> latencies = {};
+    if (!Scan(reference, &latencies)) {
+      return -1;
+    }
+    return classifier_.Classify(latencies, reference);
+  }
+
+  // FindAccessedIndex, with the result and the latencies passed on to the
+  // decider. Returns true and the byte once it is settled, otherwise false
+  // and the best guess.
+  std::pair<bool, int> MeasureRound(int reference) {
+    std::array<uint64_t, kElements> latencies = {};
+    if (!Scan(reference, &latencies)) {
+      // Disturbed rounds carry no evidence.
+      latencies.fill(0);
+      return decider_.Add(-1, latencies, reference);
+    }
+    return decider_.Add(classifier_.Classify(latencies, reference), latencies,
+                        reference);
+  }
+
+  // Forgets the rounds of the previous byte.
+  void NextByte() { decider_.Reset(); }
+
+  // Attaches an InterruptDetector, see CacheSideChannel.
+  void SetInterruptDetector(InterruptDetector *detector) {
+    interrupt_detector_ = detector;
+  }
+
+ private:
+  // Reads the oracle in scan order until the classifier has seen enough, and
+  // stores the latencies by index. Elements not read stay 0. Returns false if
+  // the attached InterruptDetector flags the round as disturbed.
+  bool Scan(int reference, std::array<uint64_t, kElements> *latencies) {
+    // Scan order for the detector.
+    std::array<uint64_t, kElements> scan_latencies;
+    classifier_.BeginScan();
+    if (interrupt_detector_) {
+      interrupt_detector_->BeginScan();
+    }
+    size_t n = 0;
+    while (n < kElements) {
+      size_t i = layout_.ScanIndex(n);
+      uint64_t latency = Timer::Measure(&layout_[i]);
+      (*latencies)[i] = scan_latencies[n++] = latency;
+      if (classifier_.Observe(i, latency, reference)) {
+        break;
+      }
+    }
+    return !interrupt_detector_ ||
+           !interrupt_detector_->EndScan(scan_latencies.data(), n);
+  }
+
+  // Measures every element cached and flushed, in scan order like a scan, for
+  // the classifier.
+  void Calibrate() {
+    const int rounds = 20;
+
+    std::vector<uint64_t> hits, misses;
+    for (int round = 0; round < rounds; ++round) {
+      for (size_t n = 0; n < kElements; ++n) {
+        ForceRead(&layout_[n]);
+      }
+      for (size_t n = 0; n < kElements; ++n) {
+        hits.push_back(Timer::Measure(&layout_[layout_.ScanIndex(n)]));
+      }
+      for (size_t n = 0; n < kElements; ++n) {
+        FlushDataCacheLineNoBarrier(&layout_[n]);
+      }
+      MemoryAndSpeculationBarrier();
+      for (size_t n = 0; n < kElements; ++n) {
+        misses.push_back(Timer::Measure(&layout_[layout_.ScanIndex(n)]));
+      }
+    }
+    classifier_.Calibrate(hits, misses);
+  }
+
+  Layout layout_;
+  Classifier classifier_;
+  Decider decider_;
+  size_t reference_counter_ = 0;
+  InterruptDetector *interrupt_detector_ = nullptr;
+};
+
+template <typename Layout, typename Timer, typename Classifier,
+          typename Decider>
+const size_t SideChannel<Layout, Timer, Classifier, Decider>::kElements;
+
+// The two existing channels as policies.
+using TimingArrayChannel = SideChannel<TimingArrayLayout, ReadLatencyTimer,
+                                       ThresholdClassifier, FirstHitDecider>;
+using ScoringChannel = SideChannel<BigByteLayout, ReadLatencyTimer,
+                                   MedianClassifier, ScoreDecider>;
+// ScoringChannel with soft decoding.
+using SoftScoringChannel = SideChannel<BigByteLayout, ReadLatencyTimer,
+                                       MedianClassifier, SoftDecoder>;
+
+#endif  // DEMOS_SIDE_CHANNEL_H_
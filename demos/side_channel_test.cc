@@ -0,0 +1,80 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "side_channel.h"
+
+#include <iostream>
+#include <string>
+
+#include "cpu_isolation.h"
+#include "utils.h"
+
+namespace {
+
+// Leaks every byte value through `Channel`, with an architectural read as the
+// "leak", and returns how many came out right.
+template <typename Channel>
+int LeakAllValues() {
+  Channel channel;
+  int correct = 0;
+  for (int value = 0; value < 256; ++value) {
+    channel.NextByte();
+    std::pair<bool, int> result(false, -1);
+    for (int run = 0; run < 100000 && !result.first; ++run) {
+      channel.FlushOracle();
+      int reference = channel.AddReferenceHit();
+      ForceRead(&channel[value]);
+      result = channel.MeasureRound(reference);
+    }
+    if (result.first && result.second == value) {
+      ++correct;
+    }
+  }
+  return correct;
+}
+
+// Runs LeakAllValues and reports the result. Returns false if fewer than
+// `required` values came out right.
+template <typename Channel>
+bool Check(const std::string &name, int required) {
+  int correct = LeakAllValues<Channel>();
+  std::cout << name << ": " << correct << " of 256 values" << std::endl;
+  return correct >= required;
+}
+
+}  // namespace
+
+// The two configurations that reproduce TimingArray and CacheSideChannel must
+// leak every value. The other combinations must work too, but may make the
+// occasional mistake: a single false positive is final for FirstHitDecider.
+int main() {
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+
+  bool ok = true;
+  ok &= Check<TimingArrayChannel>("TimingArrayChannel", 256);
+  ok &= Check<ScoringChannel>("ScoringChannel", 256);
+  ok &= Check<SoftScoringChannel>("SoftScoringChannel", 256);
+
+  const int kMostly = 240;
+  ok &= Check<SideChannel<TimingArrayLayout, ReadLatencyTimer,
+                          MedianClassifier, ScoreDecider>>(
+      "TimingArrayLayout, MedianClassifier, ScoreDecider", kMostly);
+  ok &= Check<SideChannel<BigByteLayout, ReadLatencyTimer, ThresholdClassifier,
+                          ScoreDecider>>(
+      "BigByteLayout, ThresholdClassifier, ScoreDecider", kMostly);
+  ok &= Check<SideChannel<BigByteLayout, ReadLatencyTimer, MedianClassifier,
+                          FirstHitDecider>>(
+      "BigByteLayout, MedianClassifier, FirstHitDecider", kMostly);
+  ok &= Check<SideChannel<TimingArrayLayout, TimestampTimer,
+                          MedianClassifier, ScoreDecider>>(
+      "TimingArrayLayout, TimestampTimer, MedianClassifier, ScoreDecider",
+      kMostly);
+  return ok ? 0 : 1;
+}
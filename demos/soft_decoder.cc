@@ -0,0 +1,137 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "soft_decoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+constexpr double SoftDecoder::kClip;
+constexpr double SoftDecoder::kDecisionOdds;
+constexpr double SoftDecoder::kLeakRate;
+constexpr size_t SoftDecoder::kMinReads;
+
+void SoftDecoder::Reset() {
+  log_likelihoods_.fill(0);
+  latency_sums_.fill(0);
+  min_latencies_.fill(std::numeric_limits<double>::infinity());
+  counts_.fill(0);
+  rounds_ = 0;
+  miss_level_ = 0;
+  miss_spread_ = 0;
+}
+
+std::pair<bool, int> SoftDecoder::Add(
+    const std::array<uint64_t, 256> &latencies, int reference) {
+  // The measured latencies, partially ordered below for the quantiles.
+  std::array<uint64_t, 256> sorted;
+  size_t n = 0;
+  for (int i = 0; i < 256; ++i) {
+    if (latencies[i] != 0) {
+      sorted[n++] = latencies[i];
+    }
+  }
+
+  double miss, spread, fastest;
+  uint64_t *begin = sorted.data();
+  if (n >= kMinReads) {
+    // Median, then the quartiles on either side of it, then the minimum below
+    // the lower quartile.
+    std::nth_element(begin, begin + n / 2, begin + n);
+    std::nth_element(begin, begin + n / 4, begin + n / 2);
+    std::nth_element(begin + n / 2, begin + 3 * n / 4, begin + n);
+    miss = sorted[n / 2];
+    // A robust estimate of the spread of misses, from the interquartile range.
+    spread = (sorted[3 * n / 4] - sorted[n / 4]) / 1.349;
+    fastest = *std::min_element(begin, begin + n / 4 + 1);
+    miss_level_ = miss;
+    miss_spread_ = spread;
+  } else if (n > 0 && miss_level_ > 0) {
+    // Too few reads for their own statistics, e.g. a scan that stopped at an
+    // early hit. That hit still counts, measured against the misses of the
+    // last round that had enough reads.
+    miss = miss_level_;
+    spread = miss_spread_;
+    fastest = *std::min_element(begin, begin + n);
+  } else {
+    return Decide();
+  }
+
+  double hit = reference >= 0 && latencies[reference] != 0
+                   ? latencies[reference]
+                   : fastest;
+  double separation = miss - hit;
+  if (reference >= 0 && separation <= 0) {
+    // The reference missed; the round is disturbed.
+    return Decide();
+  }
+  if (separation > 0) {
+    // Never so small that a few ticks of jitter become decisive.
+    double sigma = std::max({spread, separation / 8, 1.0});
+
+    // log N(l; hit, sigma) - log N(l; miss, sigma), which is linear in l.
+    double slope = separation / (sigma * sigma);
+    double midpoint = (miss + hit) / 2;
+    std::array<double, 256> evidence;
+    for (int i = 0; i < 256; ++i) {
+      double measured = latencies[i] != 0;
+      double llr = slope * (midpoint - static_cast<double>(latencies[i]));
+      llr = std::max(-kClip, std::min(kClip, llr));
+      // "Secret" against "not the secret": a secret's read hits in the rounds
+      // that leaked it and misses in the others.
+      evidence[i] =
+          measured * std::log(kLeakRate * std::exp(llr) + (1 - kLeakRate));
+    }
+    // The reference is a hit by construction and says nothing about the leak.
+    if (reference >= 0) {
+      evidence[reference] = 0;
+    }
+    for (int i = 0; i < 256; ++i) {
+      log_likelihoods_[i] += evidence[i];
+    }
+    ++rounds_;
+  }
+
+  for (int i = 0; i < 256; ++i) {
+    double latency = static_cast<double>(latencies[i]);
+    double measured = latencies[i] != 0;
+    latency_sums_[i] += latency;
+    counts_[i] += measured;
+    min_latencies_[i] =
+        std::min(min_latencies_[i],
+                 measured ? latency : std::numeric_limits<double>::infinity());
+  }
+
+  return Decide();
+}
+
+std::pair<bool, int> SoftDecoder::Decide() const {
+  int best = static_cast<int>(
+      std::max_element(log_likelihoods_.begin(), log_likelihoods_.end()) -
+      log_likelihoods_.begin());
+  // Relative to the best value, which contributes exp(0) = 1.
+  double others = 0;
+  for (int i = 0; i < 256; ++i) {
+    if (i != best) {
+      others += std::exp(log_likelihoods_[i] - log_likelihoods_[best]);
+    }
+  }
+  return std::make_pair(rounds_ > 0 && others * kDecisionOdds <= 1, best);
+}
+
+double SoftDecoder::Posterior(int value) const {
+  double best = *std::max_element(log_likelihoods_.begin(),
+                                  log_likelihoods_.end());
+  double total = 0;
+  for (double log_likelihood : log_likelihoods_) {
+    total += std::exp(log_likelihood - best);
+  }
+  return std::exp(log_likelihoods_[value] - best) / total;
+}
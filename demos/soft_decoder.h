@@ -0,0 +1,116 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_SOFT_DECODER_H_
+#define DEMOS_SOFT_DECODER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// SoftDecoder leaks a byte from the raw oracle latencies of many rounds
+// without deciding anything per round.
+//
+// CacheSideChannel::RecomputeScores turns every round into a hard decision:
+// the single element faster than a cutoff scores a point, and rounds with no
+// or several such elements are thrown away. On a noisy host that is most
+// rounds. SoftDecoder instead turns every latency of every round into
+// evidence. Each round is normalized by its own median (the miss level),
+// reference (the hit level) and spread, and each element gets the log
+// likelihood ratio of "this read hit" against "this read missed" under
+// Gaussian models of the two, clipped so that a single interrupt can't
+// dominate. Since only some rounds leak the secret (kLeakRate), a miss only
+// says that this round didn't leak the value, and costs it at most
+// -log(1 - kLeakRate). The ratios add up across rounds into a log posterior
+// for every byte value, and the byte is decided once the best value is more
+// likely than all others combined by kDecisionOdds. Multi-hit rounds thereby
+// still count for the values they favor, and rounds where the secret wasn't
+// leaked simply shift every value alike.
+//
+// Alongside the posterior it keeps the mean and minimum latency of every
+// value, for diagnostics. All statistics are plain arrays over the 256 values,
+// updated in branch-free loops the compiler can vectorize, and the quantiles
+// of a round come from std::nth_element on a fixed array.
+//
+// Latencies of 0 mean "not measured", e.g. by a scan that stopped early; they
+// add no evidence. With the bounded cost of a miss, the elements such scans
+// rarely reach gain little over those they read. Rounds with fewer than
+// kMinReads reads are normalized by the last round that had enough.
+//
+// SoftDecoder is also a decision policy for SideChannel (see side_channel.h).
+//
+// Example use:
+//
+//     CacheSideChannel sidechannel;
+//     SoftDecoder decoder;
+//     std::array<uint64_t, 256> latencies;
+//     std::pair<bool, int> result(false, -1);
+//     while (!result.first) {
+//       sidechannel.FlushOracle();
+//       ForceRead(&sidechannel.GetOracle()[reference]);
+//       // ... gadget accesses the oracle ...
+//       if (sidechannel.MeasureLatencies(&latencies)) {
+//         result = decoder.Add(latencies, reference);
+//       }
+//     }
+class SoftDecoder {
+ public:
+  // Evidence per round and element is clipped to +-kClip nats.
+  static constexpr double kClip = 4;
+  // The best value must be this much more likely than all others combined.
+  static constexpr double kDecisionOdds = 10000;
+  // The assumed fraction of rounds that leak the secret.
+  static constexpr double kLeakRate = 0.5;
+  // Reads a round needs for its own miss level and spread.
+  static constexpr size_t kMinReads = 16;
+
+  SoftDecoder() { Reset(); }
+
+  // Forgets all rounds.
+  void Reset();
+
+  // Adds the latencies of one round, indexed by byte value. `reference` is a
+  // value read architecturally in the round, or -1. Returns true and the byte
+  // once it is decided, otherwise false and the current best guess.
+  std::pair<bool, int> Add(const std::array<uint64_t, 256> &latencies,
+                           int reference);
+
+  // The Decider interface of SideChannel: the classifier's hit is ignored.
+  std::pair<bool, int> Add(int, const std::array<uint64_t, 256> &latencies,
+                           int reference) {
+    return Add(latencies, reference);
+  }
+
+  // Posterior probability of `value` given all rounds so far.
+  double Posterior(int value) const;
+
+  // Rounds that carried evidence.
+  int rounds() const { return rounds_; }
+
+  double MeanLatency(int value) const {
+    return counts_[value] ? latency_sums_[value] / counts_[value] : 0;
+  }
+  double MinLatency(int value) const { return min_latencies_[value]; }
+
+ private:
+  // Returns the Add() result for the rounds so far.
+  std::pair<bool, int> Decide() const;
+
+  std::array<double, 256> log_likelihoods_;
+  std::array<double, 256> latency_sums_;
+  std::array<double, 256> min_latencies_;
+  std::array<double, 256> counts_;
+  int rounds_ = 0;
+  // Median and spread of the latencies of the last round with kMinReads.
+  double miss_level_ = 0;
+  double miss_spread_ = 0;
+};
+
+#endif  // DEMOS_SOFT_DECODER_H_
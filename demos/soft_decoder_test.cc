@@ -0,0 +1,162 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "soft_decoder.h"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+#include "cache_sidechannel.h"
+#include "side_channel.h"
+
+// Leak bytes through simulated, deterministic noisy rounds, decoding them once
+// with SoftDecoder and once with CacheSideChannel's hard decisions, and check
+// that soft decoding is right and needs fewer rounds. Then check that soft
+// decoding stays right when every scan stops at its first hit.
+namespace {
+
+uint64_t state = 0x9E3779B97F4A7C15ull;
+
+// Uniform in [0, 1).
+double Random() {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return (state >> 11) * (1.0 / (1ull << 53));
+}
+
+// Roughly normal, by the central limit theorem.
+double Normal(double mean, double sigma) {
+  double sum = 0;
+  for (int i = 0; i < 12; ++i) {
+    sum += Random();
+  }
+  return mean + (sum - 6) * sigma;
+}
+
+// One round of a noisy host: the secret is leaked only in some rounds, another
+// line often comes out cached anyway (prefetches, a neighbor's accesses), and
+// interrupts occasionally inflate a read.
+std::array<uint64_t, 256> Round(int secret, int reference) {
+  const double kHit = 80, kMiss = 300;
+  const double kLeakRate = 0.4, kSpikeRate = 0.01, kFalseHitRate = 0.5;
+
+  std::array<uint64_t, 256> latencies;
+  for (int i = 0; i < 256; ++i) {
+    double latency = Normal(kMiss, 40);
+    if (Random() < kSpikeRate) {
+      latency += 2000;
+    }
+    latencies[i] = static_cast<uint64_t>(latency);
+  }
+  latencies[reference] = static_cast<uint64_t>(Normal(kHit, 10));
+  if (Random() < kLeakRate) {
+    latencies[secret] = static_cast<uint64_t>(Normal(kHit, 10));
+  }
+  if (Random() < kFalseHitRate) {
+    latencies[static_cast<int>(Random() * 256)] =
+        static_cast<uint64_t>(Normal(kHit, 10));
+  }
+  return latencies;
+}
+
+// What a classifier that stops at the first hit sees of `latencies`: reads in
+// index order up to and including the first fast one besides the reference,
+// and 0 for the elements it never reached.
+std::array<uint64_t, 256> StopAtFirstHit(std::array<uint64_t, 256> latencies,
+                                         int reference) {
+  const uint64_t kCutoff = 190;
+  int i = 0;
+  while (i < 256 && (i == reference || latencies[i] > kCutoff)) {
+    ++i;
+  }
+  for (++i; i < 256; ++i) {
+    latencies[i] = 0;
+  }
+  return latencies;
+}
+
+}  // namespace
+
+int main() {
+  const int kBytes = 200;
+  const int kMaxRounds = 10000;
+
+  int soft_errors = 0, hard_errors = 0;
+  long soft_rounds = 0, hard_rounds = 0;
+  for (int byte = 0; byte < kBytes; ++byte) {
+    int secret = static_cast<int>(Random() * 256);
+
+    SoftDecoder soft;
+    std::pair<bool, int> result(false, -1);
+    int rounds = 0;
+    while (!result.first && rounds < kMaxRounds) {
+      int reference = (rounds * 167 + 13) & 0xFF;
+      result = soft.Add(Round(secret, reference), reference);
+      ++rounds;
+    }
+    soft_errors += result.second != secret;
+    soft_rounds += rounds;
+
+    ScoreDecider hard;
+    result = std::make_pair(false, -1);
+    rounds = 0;
+    while (!result.first && rounds < kMaxRounds) {
+      int reference = (rounds * 167 + 13) & 0xFF;
+      std::array<uint64_t, 256> latencies = Round(secret, reference);
+      int hit = CacheSideChannel::DecodeLatencies(
+          latencies, static_cast<char>(reference));
+      result = hard.Add(hit, latencies, reference);
+      ++rounds;
+    }
+    hard_errors += result.second != secret;
+    hard_rounds += rounds;
+  }
+
+  // Unmeasured elements must not be favored over measured misses.
+  int early_stop_errors = 0;
+  for (int byte = 0; byte < kBytes; ++byte) {
+    int secret = static_cast<int>(Random() * 256);
+
+    SoftDecoder soft;
+    std::pair<bool, int> result(false, -1);
+    for (int rounds = 0; !result.first && rounds < kMaxRounds; ++rounds) {
+      int reference = (rounds * 167 + 13) & 0xFF;
+      result = soft.Add(StopAtFirstHit(Round(secret, reference), reference),
+                        reference);
+    }
+    early_stop_errors += result.second != secret;
+  }
+
+  double soft_average = static_cast<double>(soft_rounds) / kBytes;
+  double hard_average = static_cast<double>(hard_rounds) / kBytes;
+  std::cout << "Soft decoding: " << soft_errors << " wrong of " << kBytes
+            << ", " << soft_average << " rounds per byte" << std::endl;
+  std::cout << "Hard decoding: " << hard_errors << " wrong of " << kBytes
+            << ", " << hard_average << " rounds per byte" << std::endl;
+  std::cout << "Soft decoding of scans stopped at the first hit: "
+            << early_stop_errors << " wrong of " << kBytes << std::endl;
+
+  bool ok = true;
+  if (soft_errors > 0) {
+    std::cout << "Soft decoding made mistakes" << std::endl;
+    ok = false;
+  }
+  if (early_stop_errors > 0) {
+    std::cout << "Soft decoding of stopped scans made mistakes" << std::endl;
+    ok = false;
+  }
+  if (soft_average * 2 > hard_average) {
+    std::cout << "Soft decoding isn't clearly faster" << std::endl;
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
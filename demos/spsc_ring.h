@@ -0,0 +1,84 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_SPSC_RING_H_
+#define DEMOS_SPSC_RING_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// A bounded, lock-free queue for exactly one producer thread and one consumer
+// thread. Neither side ever blocks or takes a lock: TryPush fails when the
+// ring is full and TryPop when it is empty, and the caller decides whether to
+// drop, retry or do something else meanwhile.
+//
+// The producer only writes `head_` and the consumer only writes `tail_`, each
+// on its own cache line, so in the steady state the two threads only share
+// the lines of the slots they hand over.
+//
+// Example use:
+//
+//     SpscRing<Round, 64> ring;
+//     // Producer thread:
+//     if (!ring.TryPush(round)) ++dropped;
+//     // Consumer thread:
+//     Round round;
+//     while (ring.TryPop(&round)) Process(round);
+template <typename T, size_t kCapacity>
+class SpscRing {
+  static_assert(kCapacity > 0 && (kCapacity & (kCapacity - 1)) == 0,
+                "The capacity must be a power of two");
+
+ public:
+  SpscRing() = default;
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  // Producer only. Copies `value` into the ring. Returns false, leaving the
+  // ring unchanged, if it is full.
+  bool TryPush(const T &value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kCapacity) {
+      return false;
+    }
+    slots_[head % kCapacity] = value;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Moves the oldest element into `*value`. Returns false if
+  // the ring is empty.
+  bool TryPop(T *value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) {
+      return false;
+    }
+    *value = slots_[tail % kCapacity];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Number of elements in the ring. Exact only when called from one of the
+  // two threads while the other is idle.
+  size_t size() const {
+    return head_.load(std::memory_order_acquire) -
+           tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  // Both counters only ever grow; wrapping of size_t is harmless because the
+  // capacity divides its range.
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+  alignas(64) std::array<T, kCapacity> slots_;
+};
+
+#endif  // DEMOS_SPSC_RING_H_
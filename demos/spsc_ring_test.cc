@@ -0,0 +1,56 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "spsc_ring.h"
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+// Pushes a long sequence of elements through a small ring from one thread to
+// another and checks that every element arrives once, intact and in order.
+// Each element is much larger than a cache line, so a consumer that could see
+// the head move before the slot is written would read torn elements.
+int main() {
+  const uint64_t kElements = 1000000;
+  using Element = std::array<uint64_t, 32>;
+  SpscRing<Element, 16> ring;
+
+  std::thread producer([&ring, kElements]() {
+    Element element;
+    for (uint64_t i = 0; i < kElements; ++i) {
+      element.fill(i);
+      while (!ring.TryPush(element)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  uint64_t errors = 0;
+  Element element;
+  for (uint64_t expected = 0; expected < kElements; ++expected) {
+    while (!ring.TryPop(&element)) {
+      std::this_thread::yield();
+    }
+    for (uint64_t word : element) {
+      if (word != expected) {
+        ++errors;
+        break;
+      }
+    }
+  }
+  producer.join();
+
+  bool empty = !ring.TryPop(&element) && ring.size() == 0;
+  std::cout << "Received " << kElements << " elements, " << errors
+            << " torn or out of order, ring "
+            << (empty ? "empty" : "not empty") << " at the end." << std::endl;
+  return errors != 0 || !empty;
+}
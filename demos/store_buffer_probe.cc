@@ -0,0 +1,208 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "store_buffer_probe.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <vector>
+
+#include "cache_sidechannel.h"
+#include "instr.h"
+#include "utils.h"
+
+namespace {
+
+// Store counts tried for the store buffer depth, in steps of kDepthStep.
+const int kMaxDepth = 192;
+const int kDepthStep = 4;
+const int kDepthTrials = 31;
+
+// Training lengths tried for the disambiguation predictor.
+const int kTrainingLengths[] = {0, 2, 8, 16, 32, 48, 64, 96};
+const int kMaxTrainingLength = 96;
+const int kBypassTrials = 100;
+
+// Median ticks from before the load of `first` until the load of `second`
+// completed, with `stores` stores to cached lines in between. Unless the
+// stores stall the core, both loads are in flight at the same time.
+uint64_t MedianTicks(const char *first, const char *second, int stores,
+                     bool flush) {
+  // Stores go to a cached buffer, so they don't wait for memory themselves.
+  static std::array<volatile uint64_t, kMaxDepth> buffer;
+
+  std::vector<uint64_t> ticks;
+  for (int trial = 0; trial < kDepthTrials; ++trial) {
+    for (volatile uint64_t &word : buffer) {
+      word = 0;
+    }
+    if (flush) {
+      FlushDataCacheLineNoBarrier(first);
+      FlushDataCacheLineNoBarrier(second);
+    } else {
+      ForceRead(first);
+      ForceRead(second);
+    }
+    MemoryAndSpeculationBarrier();
+
+    uint64_t start = ReadTimestampCounter();
+    MemoryAndSpeculationBarrier();
+    ForceRead(first);
+    for (int i = 0; i < stores; i += 4) {
+      buffer[i] = i;
+      buffer[i + 1] = i;
+      buffer[i + 2] = i;
+      buffer[i + 3] = i;
+    }
+    ForceRead(second);
+    MemoryAndSpeculationBarrier();
+    ticks.push_back(ReadTimestampCounter() - start);
+  }
+  std::sort(ticks.begin(), ticks.end());
+  return ticks[kDepthTrials / 2];
+}
+
+// The most stores after which the second miss still overlaps with the first,
+// i.e. the time stays below halfway to two serialized misses.
+int StoreBufferDepth() {
+  // On separate pages, so the first miss doesn't prefetch the second line.
+  std::unique_ptr<std::array<BigByte, 3>> lines(new std::array<BigByte, 3>);
+  const char *first = reinterpret_cast<const char *>(&(*lines)[0]);
+  const char *second = reinterpret_cast<const char *>(&(*lines)[2]);
+
+  uint64_t cached = MedianTicks(first, second, kDepthStep, false);
+  uint64_t overlapped = MedianTicks(first, second, kDepthStep, true);
+  if (overlapped <= cached) {
+    return 0;
+  }
+  uint64_t threshold = overlapped + (overlapped - cached) / 2;
+
+  // Requires two steps in a row above the threshold, to ignore single noisy
+  // medians.
+  int above = 0;
+  for (int stores = 2 * kDepthStep; stores <= kMaxDepth;
+       stores += kDepthStep) {
+    if (MedianTicks(first, second, stores, true) > threshold) {
+      if (++above == 2) {
+        return stores - 2 * kDepthStep;
+      }
+    } else {
+      above = 0;
+    }
+  }
+  return 0;
+}
+
+// Fraction of trials in which, after `training` stores through slow pointers
+// to another location, a load of `value` ran ahead of a store to it through
+// a slow pointer and encoded the stale value into the oracle.
+double BypassRate(CacheSideChannel &sidechannel, SlowPointer *slots,
+                  int training) {
+  const std::array<BigByte, 256> &oracle = sidechannel.GetOracle();
+  std::array<uint64_t, 256> latencies;
+  size_t junk, value;
+
+  int bypassed = 0;
+  for (int trial = 0; trial < kBypassTrials; ++trial) {
+    size_t fresh = (trial * 167 + 13) & 0xFF;
+    size_t stale = (fresh + 1 + trial % 255) & 0xFF;
+    for (int i = 0; i < training; ++i) {
+      slots[i].pointer = &junk;
+    }
+    slots[training].pointer = &value;
+
+    // The same batched flushes as spectre_v4: one barrier for all pointers.
+    for (int i = 0; i <= training; ++i) {
+      FlushDataCacheLineNoBarrier(&slots[i].pointer);
+    }
+    sidechannel.FlushOracle();
+
+    for (int i = 0; i <= training; ++i) {
+      // value = (i == training) ? stale : fresh, without a branch.
+      value = stale + (fresh - stale) * static_cast<bool>(i - training);
+      *slots[i].pointer = fresh;
+      ForceRead(&oracle[value]);
+    }
+
+    if (sidechannel.MeasureLatencies(&latencies) &&
+        CacheSideChannel::DecodeLatencies(latencies, static_cast<char>(
+                                                         fresh)) ==
+            static_cast<int>(stale)) {
+      ++bypassed;
+    }
+  }
+  return static_cast<double>(bypassed) / kBypassTrials;
+}
+
+}  // namespace
+
+StoreBufferBehavior ProbeStoreBuffer() {
+  StoreBufferBehavior behavior;
+  behavior.store_buffer_depth = StoreBufferDepth();
+
+  CacheSideChannel sidechannel;
+  std::unique_ptr<std::array<SlowPointer, kMaxTrainingLength + 1>> slots(
+      new std::array<SlowPointer, kMaxTrainingLength + 1>);
+  for (int training : kTrainingLengths) {
+    double rate = BypassRate(sidechannel, slots->data(), training);
+    behavior.bypass_rates.push_back(std::make_pair(training, rate));
+  }
+
+  // The rates are noisy, so the best training length is picked by the mean
+  // rate of each length and its neighbours.
+  behavior.training_length = -1;
+  double best = 0;
+  const std::vector<std::pair<int, double>> &rates = behavior.bypass_rates;
+  for (size_t k = 0; k < rates.size(); ++k) {
+    size_t begin = k > 0 ? k - 1 : 0;
+    size_t end = std::min(k + 2, rates.size());
+    double sum = 0;
+    for (size_t n = begin; n < end; ++n) {
+      sum += rates[n].second;
+    }
+    double mean = sum / (end - begin);
+    if (mean > best) {
+      best = mean;
+      behavior.training_length = rates[k].first;
+    }
+  }
+  return behavior;
+}
+
+void PrintStoreBufferBehavior(const StoreBufferBehavior &behavior,
+                              std::ostream &out) {
+  out << "Store buffer depth: ";
+  if (behavior.store_buffer_depth > 0) {
+    out << behavior.store_buffer_depth << " stores" << std::endl;
+  } else {
+    out << "unknown" << std::endl;
+  }
+  out << "Store bypass rate by training length:";
+  for (const std::pair<int, double> &rate : behavior.bypass_rates) {
+    out << "  " << rate.first << ": " << std::fixed << std::setprecision(2)
+        << rate.second;
+  }
+  out << std::endl;
+  if (behavior.training_length < 0) {
+    out << "Loads never bypassed a store, is Speculative Store Bypass "
+           "Disable on?"
+        << std::endl;
+  }
+}
+
+size_t StoreBypassIterations(const StoreBufferBehavior &behavior) {
+  int training = std::max(behavior.training_length, 0);
+  if (behavior.store_buffer_depth > 0) {
+    training = std::min(training, behavior.store_buffer_depth);
+  }
+  return static_cast<size_t>(training) + 1;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_STORE_BUFFER_PROBE_H_
+#define DEMOS_STORE_BUFFER_PROBE_H_
+
+#include <cstddef>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "hardware_constants.h"
+
+// Tools for finding out how the store buffer and the memory disambiguation
+// predictor of the running CPU behave, and for sizing a store bypass
+// (Spectre v4) gadget accordingly.
+//
+// A store bypass gadget stores through a pointer that is slow to load, so the
+// store's address is unknown for a while, and right after loads the location
+// the store overwrites. If the disambiguation predictor expects the load not
+// to alias the store, the load runs ahead and returns the stale value. The
+// predictor learns per load: after an aliasing store caught the load, it has
+// to be trained back to "no alias" with a few stores to other locations. Those
+// stores all wait for their slow addresses in the store buffer, so the
+// training is limited by the store buffer's depth.
+//
+// Example use, at the beginning of `main`:
+//
+//     StoreBufferBehavior behavior = ProbeStoreBuffer();
+//     PrintStoreBufferBehavior(behavior, std::cout);
+//     size_t iterations = StoreBypassIterations(behavior);
+
+// A pointer alone on its page, as store bypass gadgets store through: loading
+// it is always a miss, since no prefetcher brings it in while the pointers
+// before it are loaded.
+struct SlowPointer {
+  size_t *pointer;
+  unsigned char padding[kPageBytes - sizeof(size_t *)];
+};
+
+struct StoreBufferBehavior {
+  // How many stores can follow a cache miss before a second, independent
+  // miss can no longer overlap with it. The smaller of the store buffer and
+  // what of the reorder buffer the stores fill. 0 if no limit was found.
+  int store_buffer_depth;
+  // For each tried training length n: the fraction of trials in which a load
+  // bypassed an aliasing store with a slow address after n non-aliasing ones.
+  std::vector<std::pair<int, double>> bypass_rates;
+  // The training length with the best bypass rate, averaged with its
+  // neighbours in bypass_rates. -1 if loads never bypassed, e.g. with
+  // Speculative Store Bypass Disable.
+  int training_length;
+};
+
+// Measures both, in a few hundred milliseconds.
+StoreBufferBehavior ProbeStoreBuffer();
+
+void PrintStoreBufferBehavior(const StoreBufferBehavior &behavior,
+                              std::ostream &out);
+
+// Iterations for a store bypass gadget loop: training_length non-aliasing
+// stores and the aliasing one, capped so that all of them fit into the store
+// buffer at once. At least 1.
+size_t StoreBypassIterations(const StoreBufferBehavior &behavior);
+
+#endif  // DEMOS_STORE_BUFFER_PROBE_H_
@@ -12,32 +12,110 @@
 #include <algorithm>
 #include <cstdint>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <vector>
 
 #include "asm/measurereadlatency.h"
+#include "core_types.h"
 #include "instr.h"
 #include "utils.h"
 
-TimingArray::TimingArray() {
-  // Explicitly initialize the elements of the array.
-  //
-  // It's not important what value we write as long as we force *something* to
-  // be written to each element. Otherwise, the backing allocation could be a
-  // range of zero-fill-on-demand (ZFOD), copy-on-write pages that all start
-  // off mapped to the same physical page of zeros. Since the cache on modern
-  // Intel CPUs is physically tagged, some elements might map to the same cache
-  // line and we wouldn't observe a timing difference between reading accessed
-  // and unaccessed elements.
-  for (int i = 0; i < size(); ++i) {
-    ElementAt(i) = -1;
+namespace {
+
+OraclePermutation default_permutation = {113, 100};
+
+}  // namespace
+
+OraclePermutation TimingArray::DefaultPermutation() {
+  return default_permutation;
+}
+
+void TimingArray::SetDefaultPermutation(const OraclePermutation &permutation) {
+  default_permutation = permutation;
+}
+
+TimingArray::TimingArray(const OraclePermutation &permutation)
+    : permutation_(permutation) {
+  std::vector<int> colors;
+  arena_ = OracleArena::Acquire(1, &colors);
+  color_ = colors[0];
+
+  calibrations_.resize(CoreTypeCount());
+  SwitchToCurrentCoreType();
+}
+
+TimingArray::~TimingArray() { arena_->ReleaseColors({color_}); }
+
+bool TimingArray::SwitchToCurrentCoreType() {
+  // Skip the CPU lookup on processors with a single core type.
+  if (calibrations_.size() > 1) {
+    core_type_ = CurrentCoreType();
+  }
+  Calibration &calibration = calibrations_[core_type_];
+  if (calibration.calibrated) {
+    return false;
+  }
+
+  // Init the first time through on each core type, then keep for later
+  // instances.
+  static std::mutex mutex;
+  static std::map<int, uint64_t> thresholds;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = thresholds.find(core_type_);
+    if (it == thresholds.end()) {
+      it = thresholds.emplace(core_type_, FindCachedReadLatencyThreshold())
+               .first;
+    }
+    calibration.threshold = it->second;
+  }
+
+  // Unlike the threshold, the profiles depend on where this instance's
+  // elements are in physical memory, so they are kept by the arena.
+  SetLineProfiles(arena_->LineProfiles(color_, core_type_, ScanPages()),
+                  &calibration);
+  calibration.calibrated = true;
+  if (frequency_monitor_) {
+    calibration.frequency_generation = frequency_monitor_->generation();
+  }
+  return true;
+}
+
+bool TimingArray::RecalibrateIfFrequencyShifted() {
+  if (!frequency_monitor_) {
+    return false;
+  }
+  Calibration &calibration = calibrations_[core_type_];
+  if (calibration.frequency_generation == frequency_monitor_->generation()) {
+    return false;
   }
 
-  // Init the first time through, then keep for later instances.
-  static uint64_t threshold = FindCachedReadLatencyThreshold();
-  cached_read_latency_threshold_ = threshold;
+  // Hits take a fixed number of core cycles and misses mostly a fixed time,
+  // so there is no single factor to rescale by. Measure both again.
+  calibration.threshold = FindCachedReadLatencyThreshold();
+  SetLineProfiles(
+      arena_->CalibrateLineProfiles(color_, core_type_, ScanPages()),
+      &calibration);
+  calibration.frequency_generation = frequency_monitor_->generation();
+  return true;
+}
+
+void TimingArray::SetFrequencyMonitor(FrequencyMonitor *monitor) {
+  frequency_monitor_ = monitor;
+  if (monitor) {
+    for (Calibration &calibration : calibrations_) {
+      calibration.frequency_generation = monitor->generation();
+    }
+  }
 }
 
 void TimingArray::FlushFromCache() {
+  // Measure before the flush, so that measuring can't disturb the round.
+  if (frequency_monitor_) {
+    frequency_monitor_->Update();
+  }
+
   // We only need to flush the cache lines with elements on them.
   for (int i = 0; i < size(); ++i) {
     FlushDataCacheLineNoBarrier(&ElementAt(i));
@@ -45,6 +123,10 @@ void TimingArray::FlushFromCache() {
 
   // Wait for flushes to finish.
   MemoryAndSpeculationBarrier();
+
+  if (interrupt_detector_) {
+    interrupt_detector_->BeginRound();
+  }
 }
 
 int TimingArray::FindFirstCachedElementIndexAfter(int start_after) {
@@ -53,18 +135,51 @@ int TimingArray::FindFirstCachedElementIndexAfter(int start_after) {
     return -1;
   }
 
+  // Calibrating brings the elements into the cache, so there is nothing to
+  // find this time.
+  if (SwitchToCurrentCoreType() || RecalibrateIfFrequencyShifted()) {
+    return -1;
+  }
+  std::vector<LatencyProfile> &line_profiles =
+      calibrations_[core_type_].line_profiles;
+
+  // Latencies in scan order, to update the line profiles and for the
+  // interrupt detector.
+  std::array<uint64_t, kRealElements> latencies;
+  if (interrupt_detector_) {
+    interrupt_detector_->BeginScan();
+  }
+
   // Start at the element after `start_after`, wrapping around until we've
   // found a cached element or tried every element.
-  for (int i = 1; i <= size(); ++i) {
+  int found = -1;
+  int i;
+  for (i = 1; i <= size(); ++i) {
     int el = (start_after + i) % size();
     uint64_t read_latency = MeasureReadLatency(&ElementAt(el));
-    if (read_latency <= cached_read_latency_threshold_) {
-      return el;
+    latencies[i - 1] = read_latency;
+    if (line_profiles[el].IsHit(read_latency)) {
+      found = el;
+      break;
     }
   }
 
-  // Didn't find a cached element.
-  return -1;
+  size_t scanned = std::min<size_t>(i, size());
+  if (interrupt_detector_ &&
+      interrupt_detector_->EndScan(latencies.data(), scanned)) {
+    return -1;
+  }
+
+  // Learn from the scan: everything before the hit was a miss.
+  for (size_t j = 0; j < scanned; ++j) {
+    int el = (start_after + 1 + j) % size();
+    if (el != found) {
+      line_profiles[el].LearnMiss(latencies[j]);
+    }
+  }
+
+  // -1 if we didn't find a cached element.
+  return found;
 }
 
 int TimingArray::FindFirstCachedElementIndex() {
@@ -72,6 +187,21 @@ int TimingArray::FindFirstCachedElementIndex() {
   return FindFirstCachedElementIndexAfter(size() - 1);
 }
 
+std::vector<size_t> TimingArray::ScanPages() const {
+  std::vector<size_t> pages;
+  for (size_t i = 0; i < size(); ++i) {
+    pages.push_back(permutation_(i));
+  }
+  return pages;
+}
+
+void TimingArray::SetLineProfiles(const std::vector<LatencyProfile> &by_page,
+                                  Calibration *calibration) const {
+  for (size_t i = 0; i < size(); ++i) {
+    calibration->line_profiles[i] = by_page[permutation_(i)];
+  }
+}
+
 // Determines a threshold value (as returned from MeasureReadLatency) at or
 // below which it is very likely the value was read from the cache without
 // going to main memory.
@@ -12,9 +12,16 @@
 
 #include <array>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
+#include "frequency_monitor.h"
 #include "hardware_constants.h"
+#include "latency_profile.h"
+#include "oracle_arena.h"
+#include "oracle_permutation.h"
+#include "realtime.h"
 
 // TimingArray is an indexable container that makes it easy to induce and
 // measure cache timing side-channels to leak the value of a single byte.
@@ -33,6 +40,20 @@
 //     sets, optimizing the use of L1 and L2 caches and therefore improving
 //     side-channel signal by increasing the timing difference between cached
 //     and uncached accesses.
+//   - The pages are shared with other TimingArrays and MultiTimingArrays, each
+//     using different lines of them (see oracle_arena.h), so concurrent leaks
+//     don't multiply the memory and TLB footprint.
+//   - Each element is classified with its own LatencyProfile rather than one
+//     threshold for all, since the remaining differences between elements
+//     (DRAM banks, TLB reach, set conflicts) are systematic. The profiles are
+//     calibrated once per arena line (see oracle_arena.h), copied on
+//     construction and updated by every scan.
+//   - On hybrid processors, the threshold and profiles are kept per core type
+//     (see core_types.h), since P-cores and E-cores have different caches. A
+//     scan that finds itself on a core type it hasn't calibrated for yet
+//     calibrates and reports no cached element (-1), so callers simply retry.
+//     The same goes for core frequency shifts when a FrequencyMonitor is
+//     attached.
 //
 // TimingArray also includes convenience functions for cache manipulation and
 // timing measurement.
@@ -65,11 +86,15 @@ class TimingArray {
   // leak more than a byte at a time significantly increases noise due to
   // greater cache contention.
   //
-  // "Real" elements because we add buffer elements before and after. See
-  // comment on `elements_` below.
+  // "Real" elements because the pages are bracketed by OracleArena's guard
+  // pages, which keep other data and prefetches away from the first and last
+  // elements. See oracle_arena.h.
   static const size_t kRealElements = 256;
 
-  TimingArray();
+  // Uses the default permutation, see SetDefaultPermutation.
+  TimingArray() : TimingArray(DefaultPermutation()) {}
+  explicit TimingArray(const OraclePermutation &permutation);
+  ~TimingArray();
 
   TimingArray(TimingArray&) = delete;
   TimingArray& operator=(TimingArray&) = delete;
@@ -80,14 +105,14 @@ class TimingArray {
     // As mentioned in the class comment, we try to frustrate hardware
     // prefetchers by applying a permutation so elements don't appear in memory
     // in index order. The mapping is pretty simple: we multiply by an odd
-    // number and mod by 256. Any odd number 1<n<256 will cover the range, but
-    // we choose one that generates a sufficiently "random-looking" sequence.
-    // We also add an offset so that the first element isn't first in memory.
-    static_assert(kRealElements == 256, "consider changing 113");
-    size_t el = (100 + i*113) % kRealElements;
-
-    // Add 1 to skip leading buffer element.
-    return elements_[1 + el].cache_lines[0].value;
+    // number and mod by 256. The default multiplier, 113, generates a
+    // sufficiently "random-looking" sequence, and the offset keeps the first
+    // element from being first in memory. SelectOraclePermutation in
+    // prefetch_probe.h can pick a better one for the running CPU.
+    static_assert(kRealElements == 256, "OraclePermutation is mod 256");
+    size_t el = permutation_(i);
+
+    return *reinterpret_cast<ValueType *>(arena_->Line(el, color_));
   }
 
   // We intentionally omit the "const" accessor:
@@ -98,6 +123,14 @@ class TimingArray {
 
   size_t size() const { return kRealElements; }
 
+  const OraclePermutation &permutation() const { return permutation_; }
+
+  // The permutation of TimingArrays constructed from now on with the default
+  // constructor. Initially {113, 100}. Set it at startup, before other
+  // threads construct TimingArrays.
+  static OraclePermutation DefaultPermutation();
+  static void SetDefaultPermutation(const OraclePermutation &permutation);
+
   // Flushes all elements of the array from the cache.
   void FlushFromCache();
 
@@ -120,48 +153,72 @@ class TimingArray {
   // element read before returning -1 is `start_after`.
   int FindFirstCachedElementIndexAfter(int start_after);
 
-  // Returns the threshold value used by FindFirstCachedElementIndex to
-  // identify reads that came from cache.
+  // Returns a single threshold at or below which reads very likely came from
+  // the cache, calibrated once per process and core type for all elements.
+  // Scans classify with the per-element profiles below instead. Both refer to
+  // the core type of the last calibration or scan.
   uint64_t cached_read_latency_threshold() const {
-    return cached_read_latency_threshold_;
+    return calibrations_[core_type_].threshold;
+  }
+
+  // The latency profile FindFirstCachedElementIndex uses for element `i`.
+  const LatencyProfile& line_profile(size_t i) const {
+    return calibrations_[core_type_].line_profiles[i];
   }
 
+  // Attaches an InterruptDetector. From then on, scans it flags as disturbed
+  // report no cached element (-1), so callers simply retry. Pass nullptr to
+  // detach. The detector must outlive its use by this TimingArray.
+  void SetInterruptDetector(InterruptDetector *detector) {
+    interrupt_detector_ = detector;
+  }
+
+  // Attaches a FrequencyMonitor. From then on, FlushFromCache updates it, and
+  // the first scan after it detects a frequency shift recalibrates the current
+  // core type and reports no cached element (-1). The calibrations so far are
+  // taken to match the monitor's current generation. Pass nullptr to detach.
+  // The monitor must outlive its use by this TimingArray.
+  void SetFrequencyMonitor(FrequencyMonitor *monitor);
+
  private:
   // Convenience so we don't have (*this)[i] everywhere.
   ValueType& ElementAt(size_t i) { return (*this)[i]; }
 
-  uint64_t cached_read_latency_threshold_;
-  uint64_t FindCachedReadLatencyThreshold();
-
-  // Define a struct that is the size of a cache line. Even though we use
-  // `alignas`, there's no guarantee (up through C++17) that the struct will
-  // actually be allocated at that alignment in the common case where
-  //     kCacheLineBytes > sizeof(std::max_align_t)
-  // See the discussion of "extended alignment" requirements at
-  // https://en.cppreference.com/w/cpp/language/object#Alignment
-  struct alignas(kCacheLineBytes) CacheLineSized {
-    ValueType value;
-  };
-  static_assert(sizeof(CacheLineSized) == kCacheLineBytes, "");
-
-  // Define our "Element" struct, which will be the size of one page of memory
-  // plus one cache line. When we allocate N of these in an array, we can't
-  // tell if they'll be cache-aligned, but we know that the start of adjacent
-  // elements will be on different pages *and* different cache lines.
-  static const int kCacheLinesPerPage = kPageBytes / kCacheLineBytes;
-  struct Element {
-    std::array<CacheLineSized, kCacheLinesPerPage + 1> cache_lines;
+  OraclePermutation permutation_;
+
+  // What was calibrated on one core type.
+  struct Calibration {
+    bool calibrated = false;
+    // FrequencyMonitor::generation() at the time of calibration.
+    uint64_t frequency_generation = 0;
+    uint64_t threshold = 0;
+    // Indexed like the array, not by position in memory.
+    std::vector<LatencyProfile> line_profiles =
+        std::vector<LatencyProfile>(kRealElements);
   };
-  static_assert(sizeof(Element) == kPageBytes + kCacheLineBytes, "");
-
-  // The actual backing store for the timing array, with buffer elements before
-  // and after to avoid interference from adjacent heap allocations.
-  //
-  // We use `vector` here instead of `array` to avoid problems where
-  // `TimingArray` is put on the stack and the class is so large it skips past
-  // the stack guard page. This is more likely on PowerPC where the page size
-  // (and therefore our element stride) is 64K.
-  std::vector<Element> elements_{1 + kRealElements + 1};
+  // Indexed by core type.
+  std::vector<Calibration> calibrations_;
+  int core_type_ = 0;
+
+  // Makes the calibration of the current core type current, calibrating it if
+  // needed. Returns true if it calibrated, which disturbs the cache.
+  bool SwitchToCurrentCoreType();
+  // Recalibrates the current core type if the attached FrequencyMonitor saw a
+  // shift since it was calibrated. Returns true if it did.
+  bool RecalibrateIfFrequencyShifted();
+  uint64_t FindCachedReadLatencyThreshold();
+  // The arena pages of the elements, in index order.
+  std::vector<size_t> ScanPages() const;
+  // Copies the arena's profiles, indexed by page, into `calibration`.
+  void SetLineProfiles(const std::vector<LatencyProfile> &by_page,
+                       Calibration *calibration) const;
+
+  InterruptDetector *interrupt_detector_ = nullptr;
+  FrequencyMonitor *frequency_monitor_ = nullptr;
+
+  // The elements are the lines of color `color_` in a shared OracleArena.
+  std::shared_ptr<OracleArena> arena_;
+  int color_;
 };
 
 #endif  // DEMOS_TIMING_ARRAY_H_
@@ -10,14 +10,27 @@
 #include "timing_array.h"
 
 #include <iostream>
+#include <vector>
 
+#include "cpu_isolation.h"
+#include "frequency_monitor.h"
 #include "instr.h"
+#include "prefetch_probe.h"
 #include "utils.h"
 
 // Measure how often TimingArray is able to accurately determine which element
 // was read into cache and how often it positively identifies the *wrong*
 // element.
 int main(int argc, char* argv[]) {
+  CpuIsolation isolation;
+  isolation.PrintReport(std::cout);
+  // Calibrate at the clock the test runs at, not while the core ramps up.
+  FrequencyMonitor::WarmUp();
+
+  // Lay the array out in the order that triggers the fewest prefetches here.
+  PrintPrefetcherBehavior(ProbePrefetchers(), std::cout);
+  SelectOraclePermutation(&std::cout);
+
   TimingArray ta;
 
   std::cout << "Cached read latency threshold is "
@@ -27,6 +40,7 @@ int main(int argc, char* argv[]) {
   int successes = 0;
   int false_positives = 0;
   int previous_el = -1;
+  std::vector<int> attempts_per_el(ta.size()), successes_per_el(ta.size());
 
   for (int n = 0; n < attempts; ++n) {
     // Choose a random byte and attempt to leak it through the cache timing
@@ -36,8 +50,10 @@ int main(int argc, char* argv[]) {
     ForceRead(&ta[el]);
 
     int found = ta.FindFirstCachedElementIndex();
+    ++attempts_per_el[el];
     if (found == el) {
       ++successes;
+      ++successes_per_el[el];
     } else if (found != -1) {
       std::cout << "False positive. Found " << found
                 << " instead of " << el
@@ -56,8 +72,30 @@ int main(int argc, char* argv[]) {
             << successes << " of " << attempts << " times." << std::endl;
   std::cout << "False positives: " << false_positives << std::endl;
 
-  // Expect most attempts to succeed and very few false positives.
-  bool pass =
-      successes > (attempts * 0.85) && false_positives < (attempts * 0.05);
+  // Elements are classified with their own latency profiles, so no element
+  // should be much harder to find than the rest.
+  size_t worst_el = 0;
+  double worst_rate = 1;
+  for (size_t el = 0; el < ta.size(); ++el) {
+    if (attempts_per_el[el] == 0) {
+      continue;
+    }
+    double rate =
+        static_cast<double>(successes_per_el[el]) / attempts_per_el[el];
+    if (rate < worst_rate) {
+      worst_el = el;
+      worst_rate = rate;
+    }
+  }
+  std::cout << "Worst element " << worst_el << " found on the first try "
+            << successes_per_el[worst_el] << " of "
+            << attempts_per_el[worst_el] << " times." << std::endl;
+
+  // Expect most attempts to succeed, very few false positives, and even the
+  // worst element to be found at least half as often as the average one.
+  double average_rate = static_cast<double>(successes) / attempts;
+  bool pass = successes > (attempts * 0.85) &&
+              false_positives < (attempts * 0.05) &&
+              worst_rate >= average_rate / 2;
   return !pass;
 }
@@ -0,0 +1,203 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#include "tlb_channel.h"
+
+#include "compiler_specifics.h"
+
+#if SAFESIDE_LINUX || SAFESIDE_MAC
+#  define SAFESIDE_TLB_CHANNEL 1
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "asm/measurereadlatency.h"
+#include "hardware_constants.h"
+#include "instr.h"
+#include "timing_array.h"
+#include "utils.h"
+
+const size_t TlbChannel::kRealElements;
+
+namespace {
+
+// Distance between element pages, in pages. Odd, so the elements still
+// spread over all sets of a set-associative TLB.
+const size_t kElementStride = 9;
+
+// Pages read to evict the element translations: over ten times the entries of
+// the largest second-level TLBs (2048 to 3072). Fewer leave many elements'
+// page-table entries in the L1 data cache, which makes their walks as fast
+// as a hit.
+const size_t kEvictionPages = 32768;
+
+const size_t kLinesPerPage = kPageBytes / kCacheLineBytes;
+
+}  // namespace
+
+TlbChannel::TlbChannel() : permutation_(TimingArray::DefaultPermutation()) {
+#if SAFESIDE_TLB_CHANNEL
+  page_size_ = sysconf(_SC_PAGESIZE);
+  elements_bytes_ = kRealElements * kElementStride * page_size_;
+  eviction_bytes_ = kEvictionPages * page_size_;
+  void *elements = mmap(nullptr, elements_bytes_, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  void *eviction = mmap(nullptr, eviction_bytes_, PROT_READ,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (elements == MAP_FAILED || eviction == MAP_FAILED) {
+    if (elements != MAP_FAILED) {
+      munmap(elements, elements_bytes_);
+    }
+    if (eviction != MAP_FAILED) {
+      munmap(eviction, eviction_bytes_);
+    }
+    return;
+  }
+#  ifdef MADV_NOHUGEPAGE
+  madvise(elements, elements_bytes_, MADV_NOHUGEPAGE);
+  madvise(eviction, eviction_bytes_, MADV_NOHUGEPAGE);
+#  endif
+  elements_ = static_cast<char *>(elements);
+  eviction_ = static_cast<char *>(eviction);
+
+  // Write the element pages, so each has its own physical page and the
+  // translations stay put.
+  for (size_t el = 0; el < kRealElements; ++el) {
+    *ElementLine(el) = 1;
+  }
+  Calibrate();
+#endif
+}
+
+TlbChannel::~TlbChannel() {
+#if SAFESIDE_TLB_CHANNEL
+  if (elements_) {
+    munmap(elements_, elements_bytes_);
+    munmap(eviction_, eviction_bytes_);
+  }
+#endif
+}
+
+char *TlbChannel::ElementLine(size_t el) const {
+  // Away from the probe line.
+  return elements_ + el * kElementStride * page_size_ +
+         (el + kLinesPerPage / 2) % kLinesPerPage * kCacheLineBytes;
+}
+
+const char *TlbChannel::ProbeLine(size_t i) const {
+  size_t el = permutation_(i);
+  // Probe lines at different offsets, so they all fit into the L1 cache.
+  return elements_ + el * kElementStride * page_size_ +
+         el % kLinesPerPage * kCacheLineBytes;
+}
+
+void TlbChannel::FlushFromCache() {
+  if (!ok()) {
+    return;
+  }
+  // Bring the probe lines' data into the cache, so that whatever the
+  // eviction leaves of it is the same for all elements.
+  for (size_t i = 0; i < kRealElements; ++i) {
+    ForceRead(ProbeLine(i));
+  }
+  for (size_t page = 0; page < kEvictionPages; ++page) {
+    ForceRead(eviction_ + page * page_size_ +
+              page % kLinesPerPage * kCacheLineBytes);
+  }
+  // The eviction took the translations of the timing code and the stack with
+  // it. Without this, the first probe read would pay for those walks too.
+  MeasureReadLatency(eviction_);
+  MemoryAndSpeculationBarrier();
+
+  if (interrupt_detector_) {
+    interrupt_detector_->BeginRound();
+  }
+}
+
+int TlbChannel::FindFirstCachedElementIndex() {
+  return FindFirstCachedElementIndexAfter(kRealElements - 1);
+}
+
+int TlbChannel::FindFirstCachedElementIndexAfter(int start_after) {
+  if (!ok() || start_after < 0 ||
+      static_cast<size_t>(start_after) >= kRealElements) {
+    return -1;
+  }
+
+  std::array<uint64_t, kRealElements> latencies;
+  if (interrupt_detector_) {
+    interrupt_detector_->BeginScan();
+  }
+  int found = -1;
+  size_t n;
+  for (n = 0; n < kRealElements; ++n) {
+    size_t i = (start_after + 1 + n) % kRealElements;
+    latencies[n] = MeasureReadLatency(ProbeLine(i));
+    if (latencies[n] <= element_thresholds_[i]) {
+      found = static_cast<int>(i);
+      ++n;
+      break;
+    }
+  }
+
+  if (interrupt_detector_ &&
+      interrupt_detector_->EndScan(latencies.data(), n)) {
+    return -1;
+  }
+  return found;
+}
+
+void TlbChannel::Calibrate() {
+  const int iterations = 200;
+
+  // One hit per flush, since every read caches its translation, and a full
+  // scan of misses of the others.
+  std::vector<uint64_t> hits, misses;
+  std::vector<std::vector<uint64_t>> element_misses(kRealElements);
+  for (int n = 0; n < iterations; ++n) {
+    size_t hit = n % kRealElements;
+    FlushFromCache();
+    ForceRead(ElementLine(permutation_(hit)));
+    MemoryAndSpeculationBarrier();
+    for (size_t i = 0; i < kRealElements; ++i) {
+      uint64_t latency = MeasureReadLatency(ProbeLine(i));
+      if (i == hit) {
+        hits.push_back(latency);
+      } else {
+        misses.push_back(latency);
+        element_misses[i].push_back(latency);
+      }
+    }
+  }
+  std::sort(hits.begin(), hits.end());
+  std::sort(misses.begin(), misses.end());
+
+  // Like ThresholdClassifier, halfway between the 90th percentile of hits and
+  // the 10th percentile of misses. But hits and misses are closer than in the
+  // data caches, and a scan reads up to 256 misses before the hit, so the
+  // threshold is kept below all but one miss in 1024 as well.
+  uint64_t hit = hits[hits.size() * 9 / 10];
+  uint64_t miss = misses[misses.size() / 10];
+  uint64_t rare_miss = misses[misses.size() / 1024];
+  threshold_ = std::min(hit < miss ? (hit + miss) / 2 : miss, rare_miss - 1);
+  uncached_latency_ = misses[misses.size() / 2];
+
+  // Some elements' walks are consistently fast, depending on where their
+  // page-table entries ended up in the caches. They get a threshold below
+  // their own misses, minus an outlier.
+  for (size_t i = 0; i < kRealElements; ++i) {
+    std::vector<uint64_t> &own = element_misses[i];
+    std::sort(own.begin(), own.end());
+    element_thresholds_[i] = std::min(threshold_, own[1] - 1);
+  }
+}
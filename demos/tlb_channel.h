@@ -0,0 +1,131 @@
+/*
+ * Copyright 2020 Google LLC
+ *
+ * Licensed under both the 3-Clause BSD License and the GPLv2, found in the
+ * LICENSE and LICENSE.GPL-2.0 files, respectively, in the root directory.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause OR GPL-2.0
+ */
+
+#ifndef DEMOS_TLB_CHANNEL_H_
+#define DEMOS_TLB_CHANNEL_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "oracle_permutation.h"
+#include "realtime.h"
+
+// TlbChannel encodes a byte in the TLB instead of the data caches, for hosts
+// where the caches are partitioned or flushed but translations survive. It
+// has TimingArray's interface, but not its reliability.
+//
+// It is not usable on virtualized hosts. Under KVM, a probe read with its
+// translation cached took a median 96 cycles and one with it evicted 144, but
+// 1% of the evicted ones were faster than 80, and which elements are fast
+// drifts after calibration. A scan reads up to 255 evicted elements before
+// the accessed one, so the first element found was wrong more often than
+// right (1793 to 678 times in one run of 10000). The wrong ones gather on a
+// few elements, which voting over rounds can't outvote either.
+// channel_benchmark reports the rates for the host it runs on.
+//
+// Each of the 256 elements is on its own page. FlushFromCache evicts the
+// pages' translations from all TLB levels by reading one line from each page
+// of a large eviction buffer, and an access to an element then leaves its
+// translation cached. Scans time a read of a different line of each element's
+// page, a "probe" line that the elements' accesses never touch and whose data
+// is in the caches for all pages alike, so the difference between a fast and a
+// slow read is the page walk alone.
+//
+//   - The element pages are nine pages apart, so that no two are virtually
+//     adjacent: the TLB can't coalesce neighbours into one entry, and the
+//     page-table entries of different elements are on different cache lines.
+//   - The eviction buffer is never written, so all its pages map the kernel's
+//     shared zero page: it costs page tables but no memory, and its reads
+//     barely disturb the data caches.
+//   - Transparent huge pages are disabled for both, since a huge page would
+//     translate many elements with one entry.
+//
+// The threshold is calibrated from scans after a single access, like
+// ThresholdClassifier's, but kept below all but the fastest misses: page walks
+// whose entries are in the data caches take only a few dozen cycles, so hits
+// and misses overlap far more than in the data caches. Each element's
+// threshold is also kept below its own misses, since where its page-table
+// entries land in the caches makes some elements' walks consistently fast.
+//
+// Linux and other systems with mmap only. Elsewhere ok() is false.
+//
+// Example use, like TimingArray:
+//
+//     TlbChannel tlb;
+//     int i = -1;
+//     while (i == -1) {
+//       tlb.FlushFromCache();
+//       ForceRead(&tlb[4]);
+//       i = tlb.FindFirstCachedElementIndex();
+//     }
+class TlbChannel {
+ public:
+  using ValueType = int;
+  static const size_t kRealElements = 256;
+
+  TlbChannel();
+  ~TlbChannel();
+
+  TlbChannel(const TlbChannel &) = delete;
+  TlbChannel &operator=(const TlbChannel &) = delete;
+
+  // Whether the pages could be set up.
+  bool ok() const { return elements_ != nullptr; }
+
+  ValueType &operator[](size_t i) {
+    return *reinterpret_cast<ValueType *>(ElementLine(permutation_(i)));
+  }
+
+  size_t size() const { return kRealElements; }
+
+  // Evicts the translations of all elements from the TLBs. Named like
+  // TimingArray's, so the two are interchangeable.
+  void FlushFromCache();
+
+  // Like TimingArray's: the first element, in index order, whose translation
+  // was cached, or -1.
+  int FindFirstCachedElementIndex();
+  int FindFirstCachedElementIndexAfter(int start_after);
+
+  // The latency at or below which a probe read found its translation cached.
+  uint64_t cached_read_latency_threshold() const { return threshold_; }
+
+  // The median probe read latency with the translation evicted, measured
+  // during calibration, for comparison with the threshold.
+  uint64_t uncached_read_latency() const { return uncached_latency_; }
+
+  // Attaches an InterruptDetector, see TimingArray.
+  void SetInterruptDetector(InterruptDetector *detector) {
+    interrupt_detector_ = detector;
+  }
+
+ private:
+  // The line of element `el`, in memory order, which accesses read.
+  char *ElementLine(size_t el) const;
+  // The probe line of element `i`, in index order.
+  const char *ProbeLine(size_t i) const;
+
+  void Calibrate();
+
+  OraclePermutation permutation_;
+  char *elements_ = nullptr;
+  size_t elements_bytes_ = 0;
+  char *eviction_ = nullptr;
+  size_t eviction_bytes_ = 0;
+  size_t page_size_ = 0;
+
+  uint64_t threshold_ = 0;
+  std::array<uint64_t, kRealElements> element_thresholds_ = {};
+  uint64_t uncached_latency_ = 0;
+  InterruptDetector *interrupt_detector_ = nullptr;
+};
+
+#endif  // DEMOS_TLB_CHANNEL_H_